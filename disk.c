@@ -1,31 +1,63 @@
 
 
+#define _GNU_SOURCE
+
 #include "disk.h"
 
-#define DISK_MAGIC 0xdeadbeef
+#include <fcntl.h>
+#include <sys/stat.h>
 
-static FILE *diskfile;
-static int nblocks = 0;
-static int nreads = 0;
-static int nwrites = 0;
+#define DISK_MAGIC 0xdeadbeef
 
 /**
  *  Initialise le disque
  *
+ * Une nouvelle image est creuse : seuls les blocs écrits occupent de la place sur l'hôte.
+ *
+ * @param disk Disque à initialiser
  * @param path Chemin d'accès à l'image disque à créer.
- * @return true si le disque est correctement initialisé
+ * @param blocks Nombre de blocs, 0 pour garder la taille d'une image existante.
+ *               Une image existante n'est jamais réduite.
+ * @return true si le disque est correctement initialisé, faux aussi si blocks est plus petit que l'image
  */
-int intialisation_disque(const char *path) {
+int intialisation_disque(struct sgf_disk *disk, const char *path, int blocks) {
     // Ouvre le descripteur de fichier vers le chemin spécifié.
-    diskfile = fopen(path, "r+");
-    if (!diskfile) diskfile = fopen(path, "w+");
-    if (!diskfile) return 0;
+    disk->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (disk->fd < 0) return 0;
+
+    // Une image existante peut être agrandie mais jamais réduite : ses derniers blocs seraient perdus
+    struct stat st;
+    int existing = fstat(disk->fd, &st) == 0 && st.st_size >= BLOCK_SIZE ? st.st_size / BLOCK_SIZE : 0;
+    if (blocks <= 0)
+        blocks = existing > 0 ? existing : BLOCKS;
+    if (blocks < existing) {
+        close(disk->fd);
+        disk->fd = -1;
+        errno = EINVAL;
+        return 0;
+    }
 
-    ftruncate(fileno(diskfile), BLOCKS * BLOCK_SIZE);
+    // ftruncate ne fait qu'ajuster la taille, les blocs ajoutés sont des trous
+    if (ftruncate(disk->fd, (off_t) blocks * BLOCK_SIZE) != 0) {
+        close(disk->fd);
+        disk->fd = -1;
+        return 0;
+    }
 
-    nblocks = BLOCKS;
-    nreads = 0;
-    nwrites = 0;
+    disk->nblocks = blocks;
+    disk->nreads = 0;
+    disk->nwrites = 0;
+    disk->nfrees = 0;
+    disk->nsyncs = 0;
+    disk->mounted = 0;
+
+    pthread_mutex_init(&disk->sync_lock, NULL);
+    pthread_cond_init(&disk->sync_done, NULL);
+    disk->syncing = 0;
+    disk->written = 0;
+    disk->synced = 0;
+    disk->dirty_first = blocks;
+    disk->dirty_last = -1;
 
     return 1;
 }
@@ -36,10 +68,10 @@ int intialisation_disque(const char *path) {
  * @param blocknum Pointeur vers la structure Disk.
  * @param data Data buffer
  */
-static void disque_ready(int blocknum, const void *data) {
+static void disque_ready(struct sgf_disk *disk, int blocknum, const void *data) {
 
     // Vérifiez si le bloc est valide.
-    if (blocknum >= nblocks || blocknum < 0) {
+    if (blocknum >= disk->nblocks || blocknum < 0) {
         abort();
     }
 
@@ -49,22 +81,35 @@ static void disque_ready(int blocknum, const void *data) {
     }
 }
 
+/**
+ * Ajoute une plage modifiée à celles que le prochain vidage doit rendre durables
+ *
+ * @param blocknum Premier bloc de la plage
+ * @param count Nombre de blocs
+ */
+static void disque_dirty(struct sgf_disk *disk, int blocknum, int count) {
+    pthread_mutex_lock(&disk->sync_lock);
+    if (blocknum < disk->dirty_first)
+        disk->dirty_first = blocknum;
+    if (blocknum + count - 1 > disk->dirty_last)
+        disk->dirty_last = blocknum + count - 1;
+    disk->written++;
+    pthread_mutex_unlock(&disk->sync_lock);
+}
+
 /**
  * Lire les données du disque au bloc spécifié dans le tampon (buffer) de données.
  *
  * @param blocknum Pointeur vers la structure Disque.
  * @param data Data buffer
  */
-void disque_read(int blocknum, char *data) {
+void disque_read(struct sgf_disk *disk, int blocknum, char *data) {
     // Exécution du contrôle d'intégrité.
-    disque_ready(blocknum, data);
-
-    // Recherche d'un bloc spécifique.
-    fseek(diskfile, blocknum * BLOCK_SIZE, SEEK_SET);
+    disque_ready(disk, blocknum, data);
 
     // Lecture du bloc dans le tampon (buffer) de données
-    if (fread(data, BLOCK_SIZE, 1, diskfile) == 1) {
-        nreads++;
+    if (pread(disk->fd, data, BLOCK_SIZE, (off_t) blocknum * BLOCK_SIZE) == BLOCK_SIZE) {
+        __sync_fetch_and_add(&disk->nreads, 1);
     } else {
         printf("Erreur d'accès au disque: %s\n", strerror(errno));
         abort();
@@ -77,31 +122,125 @@ void disque_read(int blocknum, char *data) {
  * @param blocknum
  * @param data
  */
-void disque_write(int blocknum, const char *data) {
+void disque_write(struct sgf_disk *disk, int blocknum, const char *data) {
     // Exécution du contrôle d'intégrité.
-    disque_ready(blocknum, data);
-
-    // Recherche d'un bloc spécifique.
-    fseek(diskfile, blocknum * BLOCK_SIZE, SEEK_SET);
+    disque_ready(disk, blocknum, data);
 
     // Écriture d'un buffer de données sur un bloc de disque.
-    if (fwrite(data, BLOCK_SIZE, 1, diskfile) == 1) {
-        nwrites++;
+    if (pwrite(disk->fd, data, BLOCK_SIZE, (off_t) blocknum * BLOCK_SIZE) == BLOCK_SIZE) {
+        __sync_fetch_and_add(&disk->nwrites, 1);
+        disque_dirty(disk, blocknum, 1);
     } else {
         printf("Erreur disque: %s\n", strerror(errno));
         abort();
     }
 }
 
-void disque_close() {
+/**
+ * Signale une plage de blocs libérée par le système de fichiers.
+ * La plage est percée dans l'image : elle se lit comme des zéros et ne
+ * consomme plus d'espace sur l'hôte.
+ *
+ * @param blocknum Premier bloc de la plage
+ * @param count Nombre de blocs
+ * @return vrai si la plage a été percée et se lit désormais comme des zéros
+ */
+int disque_liberer(struct sgf_disk *disk, int blocknum, int count) {
+    if (count <= 0 || blocknum < 0 || blocknum + count > disk->nblocks) {
+        abort();
+    }
+
+    if (fallocate(disk->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t) blocknum * BLOCK_SIZE, (off_t) count * BLOCK_SIZE) != 0) {
+        // Sans support du système hôte, les blocs gardent simplement leur contenu
+        if (errno != EOPNOTSUPP && errno != ENOSYS) {
+            printf("Erreur disque: %s\n", strerror(errno));
+        }
+        return 0;
+    }
+
+    __sync_fetch_and_add(&disk->nfrees, count);
+    disque_dirty(disk, blocknum, count);
+    return 1;
+}
+
+/**
+ * Nombre d'écritures et de libérations faites jusqu'ici, à passer à disque_sync_upto
+ */
+unsigned long disque_written(struct sgf_disk *disk) {
+    pthread_mutex_lock(&disk->sync_lock);
+    unsigned long written = disk->written;
+    pthread_mutex_unlock(&disk->sync_lock);
+    return written;
+}
+
+/**
+ * Rend durables les upto premières écritures. Les appels concurrents sont regroupés : pendant
+ * un vidage, les suivants attendent puis partagent un seul vidage couvrant toutes leurs écritures.
+ * La plage modifiée est écrite d'abord, fdatasync sert ensuite de barrière ; il n'a pas lieu
+ * si rien n'a été écrit depuis le dernier vidage.
+ *
+ * @param upto Valeur rendue par disque_written après les écritures à rendre durables
+ * @return vrai en cas de succès
+ */
+int disque_sync_upto(struct sgf_disk *disk, unsigned long upto) {
+    int ok = 1;
+    pthread_mutex_lock(&disk->sync_lock);
+    while (disk->synced < upto) {
+        if (disk->syncing) {
+            pthread_cond_wait(&disk->sync_done, &disk->sync_lock);
+            continue;
+        }
+        disk->syncing = 1;
+        unsigned long written = disk->written;
+        int first = disk->dirty_first;
+        int last = disk->dirty_last;
+        disk->dirty_first = disk->nblocks;
+        disk->dirty_last = -1;
+        pthread_mutex_unlock(&disk->sync_lock);
+
+        if (first <= last)
+            sync_file_range(disk->fd, (off_t) first * BLOCK_SIZE, (off_t) (last - first + 1) * BLOCK_SIZE,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        ok = fdatasync(disk->fd) == 0;
+        if (!ok)
+            printf("Erreur disque: %s\n", strerror(errno));
+        __sync_fetch_and_add(&disk->nsyncs, 1);
+
+        pthread_mutex_lock(&disk->sync_lock);
+        disk->syncing = 0;
+        if (ok && written > disk->synced)
+            disk->synced = written;
+        pthread_cond_broadcast(&disk->sync_done);
+        if (!ok)
+            break;
+    }
+    pthread_mutex_unlock(&disk->sync_lock);
+    return ok;
+}
+
+/**
+ * Rend durables les écritures déjà faites sur le disque
+ *
+ * @return vrai en cas de succès
+ */
+int disque_sync(struct sgf_disk *disk) {
+    return disque_sync_upto(disk, disque_written(disk));
+}
+
+// Les écritures sont rendues durables avant la fermeture
+void disque_close(struct sgf_disk *disk) {
     //Fermeture du disque
-    if (diskfile) {
-        fclose(diskfile);
-        diskfile = 0;
+    if (disk->fd >= 0) {
+        disque_sync(disk);
+        close(disk->fd);
+        disk->fd = -1;
+        pthread_cond_destroy(&disk->sync_done);
+        pthread_mutex_destroy(&disk->sync_lock);
     }
 }
 
 // Donne la taille du disque
-int disque_size() {
-    return nblocks;
+int disque_size(struct sgf_disk *disk) {
+    return disk->nblocks;
 }
\ No newline at end of file
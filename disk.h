@@ -2,6 +2,7 @@
 #define DISK_H
 
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/types.h>
 #include <stdio.h>
@@ -9,17 +10,44 @@
 #include <unistd.h>
 
 #define BLOCK_SIZE 4096
-#define BLOCKS 10         // Nombre de blocs définies
+#define BLOCKS 10         // Nombre de blocs par défaut d'une nouvelle image
 
-int intialisation_disque(const char *path);
+// Image disque ouverte. Les accès positionnés (pread/pwrite) peuvent venir de plusieurs threads
+struct sgf_disk {
+    int fd;
+    int nblocks;
+    int nreads;
+    int nwrites;
+    int nfrees;
+    int nsyncs;       // Vidages effectivement demandés à l'hôte
+    int mounted;      // Un système de fichiers monté utilise le disque
+    // Sous sync_lock
+    pthread_mutex_t sync_lock;
+    pthread_cond_t sync_done;
+    int syncing;            // Un vidage est en cours, les autres appelants l'attendent
+    unsigned long written;  // Écritures et libérations faites sur l'image
+    unsigned long synced;   // Les synced premières sont durables
+    int dirty_first;        // Plage des blocs modifiés depuis le dernier vidage, vide si first > last
+    int dirty_last;
+};
 
-void disque_read(int blocknum, char *data);
+int intialisation_disque(struct sgf_disk *disk, const char *path, int blocks);
 
-void disque_write(int blocknum, const char *data);
+void disque_read(struct sgf_disk *disk, int blocknum, char *data);
 
-void disque_close();
+void disque_write(struct sgf_disk *disk, int blocknum, const char *data);
 
-int disque_size();
+int disque_liberer(struct sgf_disk *disk, int blocknum, int count);
+
+unsigned long disque_written(struct sgf_disk *disk);
+
+int disque_sync_upto(struct sgf_disk *disk, unsigned long upto);
+
+int disque_sync(struct sgf_disk *disk);
+
+void disque_close(struct sgf_disk *disk);
+
+int disque_size(struct sgf_disk *disk);
 
 
 #endif
\ No newline at end of file
@@ -1,703 +1,5292 @@
 #include "fileSystem.h"
 
-int *bitmap = NULL;
-int bitmap_size;
+#include <fnmatch.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// État des blocs de fragments : octets et emplacements libres (libre = -1 si le bloc n'en est pas un)
+struct tail_etat {
+    int libre;
+    int slots;
+};
+
+// Résultat d'une recherche de nom dans un répertoire, inum = 0 si le nom est absent
+struct fs_dentry {
+    unsigned int seq; // Impair pendant une écriture, les lecteurs relisent si il a changé
+    int parent;       // Inode du répertoire, 0 si l'entrée du cache est libre
+    int inum;
+    int type;
+    char name[NAMESIZE];
+};
+
+// Copie en mémoire de toutes les entrées d'un répertoire : table de hachage rangée par tableaux,
+// dont les emplacements vont par groupes de 8 comparés d'un coup avec les instructions vectorielles
+struct fs_dircache {
+    unsigned int seq;        // Impair pendant une modification
+    int inum;                // Inode du répertoire, 0 si libre
+    unsigned long last;      // Dernière utilisation
+    int capacity;            // Puissance de 2, au moins 64
+    int nvalid;              // Emplacements occupés
+    int nused;               // Emplacements occupés ou effacés
+    unsigned int *hashes;    // Aligné sur 32 octets
+    int *inums;
+    unsigned char *types;
+    char **names;
+    uint64_t *valid;         // Un bit par emplacement occupé
+    uint64_t *used;          // Un bit par emplacement ayant servi depuis la dernière réorganisation
+};
+
+// Bits des 8 emplacements d'un groupe
+#define DIRCACHE_GROUP(bits, group) \
+    ((unsigned int) (__atomic_load_n(&(bits)[(group) / 8], __ATOMIC_ACQUIRE) >> ((group) % 8 * 8)) & 0xff)
+
+struct sgf_mount;
+static void dircache_free(struct sgf_mount *fs, struct fs_dircache *dc);
+static void aio_pool_stop(struct sgf_mount *fs);
+
+// Filtre de Bloom des noms d'un répertoire, construit à chaque chargement du répertoire en mémoire
+// et conservé après son éviction : les noms absents se reconnaissent sans lire le répertoire
+struct fs_dirbloom {
+    unsigned int seq;        // Impair pendant une modification
+    int inum;                // Inode du répertoire, 0 si libre
+    int nbits;               // Puissance de 2
+    int count;               // Noms ajoutés
+    uint64_t *bits;
+};
+
+// Bloc gardé par le cache d'écriture
+struct fs_cached {
+    int bloc;
+    unsigned long gen;       // Numéro de la dernière écriture, unique pour le cache
+    union fs_block data;
+    struct fs_cached *next;
+};
+
+struct fs_bucket {
+    pthread_mutex_t lock;
+    struct fs_cached *head;
+};
+
+// Cache d'écriture partagé par les lots : tant qu'un lot est ouvert, les blocs modifiés restent
+// en mémoire et sont écrits une seule fois quand le dernier lot se ferme. Tous les threads
+// lisent les blocs à travers lui.
+struct fs_batch {
+    int depth;               // Lots ouverts, tous threads confondus
+    int count;               // Blocs en cache
+    unsigned long gen;       // Écritures dans le cache
+    pthread_mutex_t flush_lock;
+    struct fs_bucket buckets[FS_CACHE_BUCKETS];
+};
+
+// Lot de blocs libérés, appliqué à la bitmap en une seule passe
+struct fs_freelist {
+    int *blocs;
+    int count;
+    int capacity;
+};
+
+// Journal des métadonnées d'un montage. Chaque lot ouvert hors d'un autre est une opération
+// de la transaction ouverte, qui regroupe toutes les opérations terminées depuis la
+// validation précédente. Avec un journal, le cache d'écriture n'est vidé que par une validation.
+struct fs_journal {
+    int start;               // Premier bloc de la zone, son en-tête
+    int nblocks;             // Taille de la zone
+    int running;             // Le thread de validation tourne
+    pthread_mutex_t lock;
+    pthread_cond_t cond;     // Fin d'une opération ou d'une capture
+    pthread_cond_t wake;     // Réveille le thread de validation
+    int active;              // Opérations en cours dans la transaction ouverte
+    int closing;             // Les nouvelles opérations attendent la capture de la transaction
+    int wanted;              // Le cache a atteint limit blocs
+    int stop;
+    int limit;               // Blocs en cache qui déclenchent une validation
+    struct fs_freelist freed; // Blocs libérés par la transaction ouverte
+    unsigned long opened;    // Numéro de la transaction ouverte, à partir de 1
+    pthread_t thread;
+    // Sous flush_lock
+    unsigned long durable;   // Les transactions jusqu'à ce numéro sont durables
+    unsigned int seq;        // Numéro de la prochaine transaction
+    int head;                // Position de la prochaine transaction dans la zone
+    int used;                // Blocs écrits depuis l'en-tête, pas forcément durables sur place
+    uint64_t *map;           // Bitmaps sur disque une fois les transactions validées reportées
+    uint64_t *logged;        // Blocs qu'un rejeu réécrirait, une copie étant dans le journal
+    int rescan;              // Recopié dans l'en-tête : les bitmaps sur disque ne sont pas fiables
+};
+
+// Transaction en cours de validation
+struct fs_txn {
+    unsigned long id;        // Numéro pris dans journal.opened
+    int count;
+    int ncached;             // Les ncached premiers blocs viennent du cache, les autres des bitmaps
+    int *blocs;
+    unsigned long *gens;     // Version copiée de chaque bloc du cache
+    char *data;              // Copies des blocs, à la suite
+    struct fs_freelist freed;
+};
+
+// Lecture sans verrou en cours : époque à son début, 0 si l'emplacement est libre
+struct fs_reader {
+    unsigned long epoch;
+} __attribute__((aligned(64)));
+
+// Mémoire retirée d'un cache, libérée quand aucune lecture commencée avant son retrait n'est en cours
+struct fs_retired {
+    void *ptr;
+    void (*release)(void *);
+    unsigned long epoch;     // Époque ouverte par le retrait
+    struct fs_retired *next;
+};
+
+/*
+ * Verrous d'un montage. Un thread ne prend un verrou qu'après ceux qui le précèdent
+ * dans cette liste, jamais dans l'autre sens :
+ *
+ *   1. rename_lock
+ *   2. inode_locks : lecteurs-rédacteurs par inode, plusieurs à la fois par indice croissant
+ *   3. session_lock
+ *   4. dircache_lock : modifications des caches de répertoires et recherches qu'ils ne
+ *      satisfont pas sans verrou
+ *   5. table_locks : un bloc de la table des inodes et ses bits dans inode_bitmap / inode_free
+ *   6. tail_lock : blocs de fragments
+ *   7. lazy_lock
+ *   8. flush_lock : vidage du cache d'écriture, validation d'une transaction du journal
+ *   9. journal.lock : transaction ouverte
+ *  10. group_locks : bitmap des blocs, par groupe de FS_ALLOC_GROUP blocs
+ *  11. buckets : cache d'écriture, les accès disque se font sous ces verrous
+ *
+ * Les verrous 3 à 11 ne sont gardés que le temps d'une opération sur la structure protégée.
+ * Une opération qui modifie le système de fichiers ouvre son lot avant de prendre un verrou :
+ * elle peut y attendre la validation de la transaction précédente.
+ * Ceux des requêtes asynchrones, file du montage et files de complétions, ne sont jamais
+ * gardés ensemble ni pendant un appel au système de fichiers.
+ *
+ * Les recherches dans le cache des noms, les copies en mémoire des répertoires et les filtres
+ * de Bloom ne prennent aucun verrou : chaque structure a un compteur de séquence que
+ * ses rédacteurs rendent impair le temps d'une modification, et les lecteurs recommencent
+ * ou passent par dircache_lock si le compteur a changé. La mémoire retirée de ces caches
+ * n'est libérée qu'une fois terminées les lectures qui ont pu la voir.
+ */
 
-int free_block[BLOCKS];
-int inode_counter[BLOCKS];
-int dir_counter[BLOCKS];
-struct fs_directory curr_dir;
+// Système de fichiers monté : tout l'état d'une image, plusieurs images peuvent être montées à la fois
+struct sgf_mount {
+    struct sgf_disk *disk;
+    union fs_block sb;        // Superbloc, il porte les drapeaux des groupes non initialisés
+    int *bitmap;
+    int bitmap_size;
+
+    // Allocateur de blocs : un verrou et un indice par groupe, aucun bloc libre avant l'indice
+    int ngroups;
+    pthread_mutex_t *group_locks;
+    int *group_hint;
+
+    // Inodes libres : un bit par inode et le nombre d'inodes libres de chaque bloc de la table
+    uint64_t *inode_bitmap;
+    int *inode_free;
+    int inode_hint;           // Bloc de la table où chercher d'abord un inode libre
+
+    pthread_rwlock_t inode_locks[FS_INODE_LOCKS];
+    pthread_mutex_t table_locks[FS_TABLE_LOCKS];
+    pthread_mutex_t rename_lock;
+
+    // Protège les drapeaux uninit contre le thread d'initialisation en arrière-plan
+    pthread_mutex_t lazy_lock;
+    pthread_t lazy_thread;
+    int lazy_running;
+    volatile int lazy_stop;
+
+    pthread_mutex_t tail_lock;
+    struct tail_etat *tails;
+    int tail_courant;         // Dernier bloc de fragments utilisé
+    int tail_recycle;         // Un autre bloc de fragments a récupéré de la place
+
+    struct fs_dentry *dcache;
+    pthread_mutex_t dircache_lock;
+    struct fs_dircache *dircaches;
+    unsigned long dircache_tick;
+    struct fs_dirbloom *dirblooms;
+
+    // Lectures sans verrou des caches de répertoires
+    unsigned long epoch;
+    struct fs_reader readers[FS_READERS];
+    struct fs_retired *retired;
+    int nretired;
+    struct fs_batch batch;
+    struct fs_journal journal;
+
+    // Sessions ouvertes, chacune avec son répertoire courant
+    pthread_mutex_t session_lock;
+    struct sgf_session *sessions;
+
+    // Threads des requêtes asynchrones, démarrés par la première file ouverte
+    struct fs_aio_pool *aio;
+    long aio_token;
+};
+
+// Client d'un système de fichiers monté. Seul l'inode du répertoire courant est gardé :
+// son contenu est toujours lu à travers les caches partagés du montage.
+struct sgf_session {
+    struct sgf_mount *fs;
+    struct fs_directory cwd;
+    struct sgf_session *next;
+};
+
+#define LAZY_UNINIT(fs, group) ((fs)->sb.super.uninit[(group) / 8] & (1 << ((group) % 8)))
 
-// Vérifie dans la bitmap si un block est libre
-int get_bloc() {
-    if (bitmap == NULL) {
-        printf("Vous devez monter le disque avant\n");
-        return -1;
-    }
+/**
+ * Démarre un thread interne au système de fichiers. Il bloque tous les signaux : ceux que
+ * le programme attend, comme SIGTERM pour un démon, ne sont jamais remis à l'un de ces threads.
+ *
+ * @return 0 en cas de succès, comme pthread_create
+ */
+static int thread_start(pthread_t *thread, void *(*run)(void *), void *arg) {
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int ret = pthread_create(thread, NULL, run, arg);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return ret;
+}
 
-    union fs_block block;
-    disque_read(0, block.data);
+// Compartiment du cache d'écriture d'un bloc
+#define BATCH_BUCKET(fs, bloc) (&(fs)->batch.buckets[((unsigned int) (bloc) * 2654435761u) % FS_CACHE_BUCKETS])
 
-    //Initialise le premier bloc
-    for (int i = block.super.ninodeblocks + 1; i < bitmap_size; i++) {
-        if (bitmap[i] == 0) {
-            //zero it out
-            memset(&bitmap[i], 0, sizeof(bitmap[0]));
-            return i;
+// Bloc du cache, à chercher sous le verrou du compartiment
+static struct fs_cached **batch_find(struct fs_bucket *b, int bloc) {
+    struct fs_cached **p = &b->head;
+    while (*p != NULL && (*p)->bloc != bloc)
+        p = &(*p)->next;
+    return p;
+}
+
+/**
+ * Lit un bloc, dans sa version du cache d'écriture s'il y est
+ */
+static void bloc_read(struct sgf_mount *fs, int bloc, char *data) {
+    if (__atomic_load_n(&fs->batch.count, __ATOMIC_ACQUIRE) > 0) {
+        struct fs_bucket *b = BATCH_BUCKET(fs, bloc);
+        pthread_mutex_lock(&b->lock);
+        struct fs_cached *c = *batch_find(b, bloc);
+        if (c != NULL) {
+            memcpy(data, c->data.data, BLOCK_SIZE);
+            pthread_mutex_unlock(&b->lock);
+            return;
         }
+        pthread_mutex_unlock(&b->lock);
     }
-    return -1;
+    disque_read(fs->disk, bloc, data);
 }
 
 /**
- * Format du disque
- * Fonction de formattage par le file system du disque
- * 
- * retourne un booléen à true si le disque est formaté
+ * Écrit un bloc. Pendant un lot, il reste dans le cache d'écriture. Hors lot, un bloc
+ * encore en cache y est aussi mis à jour pour qu'aucune lecture ne voie l'ancienne version.
  */
-int fs_format() {
-    union fs_block block;
-
-    if (disque_size() < 3 || bitmap != NULL) {
-        printf("Disque de taille insuffisante ou erreur de formattage de l'image monté\n");
-        return 0;
+static void bloc_write(struct sgf_mount *fs, int bloc, const char *data) {
+    struct fs_bucket *b = BATCH_BUCKET(fs, bloc);
+    pthread_mutex_lock(&b->lock);
+    struct fs_cached *c = *batch_find(b, bloc);
+    int batched = __atomic_load_n(&fs->batch.depth, __ATOMIC_ACQUIRE) > 0;
+    if (c == NULL && batched) {
+        c = malloc(sizeof(struct fs_cached));
+        if (c != NULL) {
+            c->bloc = bloc;
+            c->next = b->head;
+            b->head = c;
+            __atomic_add_fetch(&fs->batch.count, 1, __ATOMIC_RELEASE);
+        }
     }
-
-    // Définition du SuperBloc.
-    block.super.magic = FS_MAGIC;
-    block.super.nblocks = disque_size();
-    block.super.ninodeblocks = disque_size() / 10 + 1;
-    block.super.ninodes = 128 * block.super.ninodeblocks;
-    block.super.ndirblocks = disque_size() / 100 + 1;
-
-    // Ecrire le SuperBlock dans le disque
-    disque_write(0, block.data);
-
-    // Effacer tous les blocs restants
-    for (int inode_block = (block.super.ninodeblocks) + 1;
-         inode_block < block.super.ninodeblocks - block.super.ndirblocks; inode_block++) {
-        union fs_block zero;
-        memset(zero.data, 0, BLOCK_SIZE);
-        disque_write(inode_block, zero.data);
+    if (c != NULL) {
+        memcpy(c->data.data, data, BLOCK_SIZE);
+        c->gen = __atomic_add_fetch(&fs->batch.gen, 1, __ATOMIC_RELAXED);
     }
+    if (c == NULL || !batched)
+        disque_write(fs->disk, bloc, data);
+    pthread_mutex_unlock(&b->lock);
+}
 
-    // Effacer tous les répertoires restants
-    for (int i = block.super.nblocks - block.super.ndirblocks; i < block.super.nblocks; i++) {
-        union fs_block zero;
-        struct fs_directory dir;
-        dir.inum = -1;
-        dir.isvalid = 0;
-        memset(dir.table, 0, sizeof(struct fs_dirent) * ENTRIES_PER_DIR);
-        for (int j = 0; j < DIR_PER_BLOCK; j++) {
-            zero.directories[j] = dir;
-        }
-        disque_write(i, zero.data);
+/**
+ * Écrit un bloc de données d'un fichier. Avec un journal, il va directement sur le disque :
+ * seules les métadonnées sont journalisées, et les données sont écrites avant la validation
+ * de la transaction qui les rend accessibles.
+ */
+static void data_write(struct sgf_mount *fs, int bloc, const char *data) {
+    if (!fs->journal.running) {
+        bloc_write(fs, bloc, data);
+        return;
     }
+    struct fs_bucket *b = BATCH_BUCKET(fs, bloc);
+    pthread_mutex_lock(&b->lock);
+    struct fs_cached *c = *batch_find(b, bloc);
+    if (c != NULL) {
+        memcpy(c->data.data, data, BLOCK_SIZE);
+        c->gen = __atomic_add_fetch(&fs->batch.gen, 1, __ATOMIC_RELAXED);
+    }
+    disque_write(fs->disk, bloc, data);
+    pthread_mutex_unlock(&b->lock);
+}
 
-    // Définir la racine du système de fichiers
-    struct fs_directory root;
-    strcpy(root.name, "/");
-    root.inum = 0;
-    root.isvalid = 1;
+// Retire du cache un bloc libéré : son contenu n'a plus à être écrit
+static void batch_forget(struct sgf_mount *fs, int bloc) {
+    if (__atomic_load_n(&fs->batch.count, __ATOMIC_ACQUIRE) == 0) {
+        return;
+    }
+    struct fs_bucket *b = BATCH_BUCKET(fs, bloc);
+    pthread_mutex_lock(&b->lock);
+    struct fs_cached **p = batch_find(b, bloc);
+    struct fs_cached *c = *p;
+    if (c != NULL) {
+        *p = c->next;
+        free(c);
+        __atomic_sub_fetch(&fs->batch.count, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
 
-    struct fs_dirent temp;
-    memset(&temp, 0, sizeof(temp));
-    temp.inum = 0;
-    temp.type = 0;
-    temp.isvalid = 1;
-    char tstr1[] = ".";
-    char tstr2[] = "..";
-    strcpy(temp.name, tstr1);
-    memcpy(&(root.table[0]), &temp, sizeof(struct fs_dirent));
-    strcpy(temp.name, tstr2);
-    memcpy(&(root.table[1]), &temp, sizeof(struct fs_dirent));
+// Lots ouverts par le thread : seul le premier rejoint la transaction du journal
+static __thread int batch_nesting;
 
-    union fs_block dirblock;
-    memcpy(&(dirblock.directories[0]), &root, sizeof(root));
-    disque_write(block.super.nblocks - 1, dirblock.data);
+/**
+ * Ouvre un lot d'écritures. Les lots s'imbriquent et se partagent entre threads :
+ * le cache n'est vidé qu'à la fermeture du dernier lot ouvert. Avec un journal, le premier
+ * lot d'un thread attend qu'aucune transaction ne soit en train d'être capturée.
+ */
+static void batch_begin(struct sgf_mount *fs) {
+    struct fs_journal *j = &fs->journal;
+    if (j->running && batch_nesting++ == 0) {
+        pthread_mutex_lock(&j->lock);
+        while (j->closing)
+            pthread_cond_wait(&j->cond, &j->lock);
+        j->active++;
+        pthread_mutex_unlock(&j->lock);
+    }
+    __atomic_add_fetch(&fs->batch.depth, 1, __ATOMIC_ACQ_REL);
+}
 
-    return 1;
+static int compare_batch(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
 }
 
 /**
- * Monter le file system
- *
+ * Écrit chaque bloc du cache une seule fois, par numéro de bloc croissant
  *
+ * @return Nombre de blocs écrits
  */
-int fs_mount() {
-    union fs_block block;
-    // Lire et vérifier le SuperBlock
-    disque_read(0, block.data);
-
-    // Alloue la mémoire pour le bitmap
-    bitmap = calloc(block.super.nblocks, sizeof(int));
-    bitmap_size = block.super.nblocks;
-
-    // analyse le système de fichiers pour définir correctement le bitmap pour le système de fichiers donné
-    union fs_block inode_block;
-    struct fs_inode inode;
-    for (int i = 1; i < block.super.ninodeblocks; i++) {
-
-        disque_read(i, inode_block.data);
-
-        for (int i_node = 0; i_node < INODES_PER_BLOCK; i_node++) {
-
-            inode = inode_block.inode[i_node];
-
-            if (inode.isvalid) {
-                bitmap[i] = 1;
-                for (int d_blocks = 0; d_blocks * 4096 < inode.size && d_blocks < 5; d_blocks++) {
-                    bitmap[inode.direct[d_blocks]] = 1;
-                }
-
-                if (inode.size > 5 * 4096) {
-
-                    bitmap[inode.indirect] = 1;
-
-                    union fs_block temp_block;
-                    disque_read(inode.indirect, temp_block.data);
-
-                    for (int indirect_block = 0; indirect_block < (double) inode.size / 4096 - 5; indirect_block++) {
-                        bitmap[temp_block.pointers[indirect_block]] = 1;
-                    }
-                }
-            }
+static int batch_flush(struct sgf_mount *fs) {
+    pthread_mutex_lock(&fs->batch.flush_lock);
+    int capacity = __atomic_load_n(&fs->batch.count, __ATOMIC_ACQUIRE);
+    int *order = malloc((capacity > 0 ? capacity : 1) * sizeof(int));
+    int n = 0;
+    for (int i = 0; i < FS_CACHE_BUCKETS; i++) {
+        struct fs_bucket *b = &fs->batch.buckets[i];
+        pthread_mutex_lock(&b->lock);
+        for (struct fs_cached *c = b->head; c != NULL; c = c->next) {
+            if (order != NULL && n < capacity)
+                order[n++] = c->bloc;
         }
+        pthread_mutex_unlock(&b->lock);
     }
-
-    memset(dir_counter, 0, sizeof(dir_counter));
-    union fs_block dirblock;
-    for (int dirs = 0; dirs < block.super.ndirblocks; dirs++) {
-        disque_read(block.super.nblocks - 1 - dirs, dirblock.data);
-        for (int offset = 0; offset < DIR_PER_BLOCK; offset++) {
-            if (dirblock.directories[offset].isvalid == 1) {
-                dir_counter[dirs]++;
-            }
-        }
-        if (dirs == 0) {
-            curr_dir = dirblock.directories[0];
+    if (order != NULL)
+        qsort(order, n, sizeof(int), compare_batch);
+
+    // Sans mémoire pour trier, les blocs sont écrits compartiment par compartiment
+    int written = 0;
+    for (int i = 0; i < (order != NULL ? n : FS_CACHE_BUCKETS); i++) {
+        struct fs_bucket *b = order != NULL ? BATCH_BUCKET(fs, order[i]) : &fs->batch.buckets[i];
+        pthread_mutex_lock(&b->lock);
+        struct fs_cached **p = order != NULL ? batch_find(b, order[i]) : &b->head;
+        while (*p != NULL) {
+            struct fs_cached *c = *p;
+            disque_write(fs->disk, c->bloc, c->data.data);
+            *p = c->next;
+            free(c);
+            __atomic_sub_fetch(&fs->batch.count, 1, __ATOMIC_RELEASE);
+            written++;
+            if (order != NULL)
+                break;
         }
+        pthread_mutex_unlock(&b->lock);
     }
-
-    return 1;
+    free(order);
+    pthread_mutex_unlock(&fs->batch.flush_lock);
+    return written;
 }
 
 /**
- * Alloue un Inode dans la table des Inodes du Système de Fichier
+ * Ferme un lot d'écritures. À la fermeture du dernier lot ouvert, chaque bloc du cache
+ * est écrit une seule fois, par numéro de bloc croissant. Un bloc reste lisible dans
+ * le cache jusqu'à son écriture.
+ *
+ * Avec un journal, rien n'est écrit : la fin du premier lot du thread termine
+ * l'opération et réveille le thread de validation si le cache est assez rempli.
  *
- * @return Numéro de l'Inode alloué si valide
+ * @return Nombre de blocs écrits
  */
-int fs_create() {
-    if (bitmap == NULL) {
-        return 0;
-    }
-
-    union fs_block block;
-    disque_read(0, block.data);
-
-    // Recherchez la table Inode pour un inode libre.
-    for (int inode_block_index = 1; inode_block_index < block.super.nblocks; inode_block_index++) {
-        disque_read(inode_block_index, block.data);
-
-        struct fs_inode inode;
-        for (int inode_index = 0; inode_index < POINTERS_PER_BLOCK; inode_index++) {
-            if (inode_index == 0 && inode_block_index == 1)
-                inode_index = 1;
-
-            // lire l'espace comme un inode, et vérifier le flag valide
-            inode = block.inode[inode_index];
-
-            if (inode.isvalid == 0) {
-
-                // si l'inode est invalide, nous pouvons remplir l'espace en toute sécurité
-                inode.isvalid = 1;
-                inode.size = 0;
-                memset(inode.direct, 0, sizeof(inode.direct));
-                inode.indirect = 0;
-
-                bitmap[inode_block_index] = 1;
-                block.inode[inode_index] = inode;
-                disque_write(inode_block_index, block.data);
-                return inode_index + (inode_block_index - 1) * 128;
+static int batch_commit(struct sgf_mount *fs) {
+    struct fs_journal *j = &fs->journal;
+    int depth = __atomic_sub_fetch(&fs->batch.depth, 1, __ATOMIC_ACQ_REL);
+    if (j->running) {
+        if (--batch_nesting == 0) {
+            pthread_mutex_lock(&j->lock);
+            int count = __atomic_load_n(&fs->batch.count, __ATOMIC_RELAXED);
+            if (count >= j->limit) {
+                j->wanted = 1;
+                pthread_cond_signal(&j->wake);
+                // Le cache ne grandit plus tant que le thread de validation est en retard
+                if (count >= 2 * j->limit)
+                    j->closing = 1;
             }
+            if (--j->active == 0 && j->closing)
+                pthread_cond_broadcast(&j->cond);
+            pthread_mutex_unlock(&j->lock);
         }
-    }
-    return 0;
-}
-
-/**
- * Suppression de l'Inode et des données associées du Système de Fichier
- * @param inumber Inode à supprimer.
- * @return true si Inode supprimé
- */
-int fs_delete(int inumber) {
-    int inode_block_index = (inumber + 128 - 1) / 128;
-
-    union fs_block block;
-    disque_read(0, block.data);
-
-    if (inode_block_index > block.super.ninodeblocks) {
-        printf("Erreur de limite d'inode\n");
         return 0;
     }
-    disque_read(inode_block_index, block.data);
-
-    struct fs_inode inode = block.inode[inumber % 128];
-    if (inode.isvalid) {
-        inode = (struct fs_inode) {0};
-        block.inode[inumber % 128] = inode;
-        disque_write(inode_block_index, block.data);
-        return 1;
-    } else {
+    if (depth > 0) {
         return 0;
     }
+    return batch_flush(fs);
 }
 
 /**
- * Lit à partir de l'inode spécifié dans le tampon de données, 
- * la longeur du tampon en commençant par l'offset spécifié
+ * Groupe d'initialisation différée d'un bloc
  *
- * @param inumber Inode pour lire les données.
- * @param data Data buffer
- * @param length Nombre d'octets à lire.
- * @param offset Décalage de l'octet à partir duquel la lecture doit commencer.
- * @return Nombre d'octets lus (-1 en cas d'erreur).
+ * @param bloc Numéro du bloc
+ * @return Index du groupe, -1 hors de la table des inodes
  */
-int fs_read(int inumber, char *data, int length, int offset) {
-    memset(data, 0, length);
-    union fs_block block;
-    disque_read(0, block.data);
-    if (inumber == 0 || inumber > block.super.ninodes) {
-        printf("Erreur inode\n");
+static int lazy_group(struct sgf_mount *fs, int bloc) {
+    if (fs->sb.super.groupblocks == 0) {
         return -1;
     }
+    if (bloc >= 1 && bloc <= fs->sb.super.ninodeblocks) {
+        return (bloc - 1) / fs->sb.super.groupblocks;
+    }
+    return -1;
+}
 
-    int total_data_read = 0;
-    int inode_block_index = (inumber + 128 - 1) / 128;
-
-    disque_read(inode_block_index, block.data);
-
-    struct fs_inode inode = block.inode[inumber % 128];
-    if (!inode.isvalid || inode.size == 0) {
-        printf("Erreur inode\n");
-    } else {
-        if (offset >= inode.size)
-            return -1;
-
-        int direct_index = (int) floor(offset / 4096);
-        union fs_block temp_block;
-
-        int max_limit = length;
-        if (inode.size < length + offset)
-            max_limit = inode.size - offset;
-
-        // Lit continuellement les blocs et copier les données dans la mémoire tampon.
-        // Bloc direct en premier puis blocs indirects
-        while (direct_index < 5 && total_data_read < max_limit) {
-
-            int chunk = 4096;
-            if (chunk + total_data_read > max_limit)
-                chunk = max_limit - total_data_read;
-
-            disque_read(inode.direct[direct_index], temp_block.data);
+/**
+ * Met à zéro les blocs d'un groupe puis le marque comme initialisé.
+ * Doit être appelé avec lazy_lock.
+ *
+ * @param group Index du groupe
+ */
+static void lazy_init_group(struct sgf_mount *fs, int group) {
+    int first = 1 + group * fs->sb.super.groupblocks;
+    int count = fs->sb.super.ninodeblocks + 1 - first;
+    if (count > fs->sb.super.groupblocks)
+        count = fs->sb.super.groupblocks;
 
-            strncat(data, temp_block.data, chunk);
-            total_data_read += chunk;
-            direct_index++;
+    if (!disque_liberer(fs->disk, first, count)) {
+        union fs_block zero;
+        memset(zero.data, 0, BLOCK_SIZE);
+        for (int i = first; i < first + count; i++) {
+            disque_write(fs->disk, i, zero.data);
         }
+    }
 
-        if (total_data_read < max_limit) {
-            union fs_block ind_block;
-            disque_read(inode.indirect, ind_block.data);
-
-            for (int indirect_block = 0;
-                 indirect_block < (double) inode.size / 4096 - 5 && total_data_read < max_limit; indirect_block++) {
-
-                disque_read(ind_block.pointers[indirect_block], temp_block.data);
-
-                int chunk = 4096;
-                if (chunk + total_data_read > max_limit)
-                    chunk = max_limit - total_data_read;
-                strncat(data, temp_block.data, chunk);
+    fs->sb.super.uninit[group / 8] &= ~(1 << (group % 8));
+    disque_write(fs->disk, 0, fs->sb.data);
+}
 
-                total_data_read += chunk;
-            }
+/**
+ * Lit un bloc de métadonnées (table des inodes).
+ * Un bloc d'un groupe non initialisé se lit comme des zéros sans accès disque.
+ *
+ * @param bloc Numéro du bloc
+ * @param data Data buffer
+ */
+static void meta_read(struct sgf_mount *fs, int bloc, char *data) {
+    int group = lazy_group(fs, bloc);
+    if (group >= 0) {
+        pthread_mutex_lock(&fs->lazy_lock);
+        int uninit = LAZY_UNINIT(fs, group);
+        pthread_mutex_unlock(&fs->lazy_lock);
+        if (uninit) {
+            memset(data, 0, BLOCK_SIZE);
+            return;
         }
-        return total_data_read;
     }
-
-    return -1;
+    bloc_read(fs, bloc, data);
 }
 
 /**
- * Ecriture via l'inode donné dans le buffer de données,
- * la longeur du buffer en commençant par l'offset spécifié
+ * Écrit un bloc de métadonnées, son groupe est initialisé à la première écriture.
  *
- * @param inumber Inode pour lire les données.
+ * @param bloc Numéro du bloc
  * @param data Data buffer
- * @param length Nombre d'octets à lire.
- * @param offset Décalage de l'octet à partir duquel la lecture doit commencer.
- * @return Nombre d'octets lus (-1 en cas d'erreur).
  */
-int fs_write(int inumber, const char *data, int length, int offset) {
-    union fs_block block;
-    disque_read(0, block.data);
-    if (inumber == 0 || inumber > block.super.ninodes) {
-        return -1;
+static void meta_write(struct sgf_mount *fs, int bloc, const char *data) {
+    int group = lazy_group(fs, bloc);
+    if (group >= 0) {
+        pthread_mutex_lock(&fs->lazy_lock);
+        if (LAZY_UNINIT(fs, group))
+            lazy_init_group(fs, group);
+        pthread_mutex_unlock(&fs->lazy_lock);
     }
+    bloc_write(fs, bloc, data);
+}
 
-    int total_wrote = 0;
-    int inode_block_index = (inumber + 128 - 1) / 128;
-
-    // Chargement des informations sur les inodes.
-    disque_read(inode_block_index, block.data);
-
-    // Copie en continu des données du tampon vers les blocs.
-    struct fs_inode inode = block.inode[inumber % 128];
-    if (!inode.isvalid) {
-        printf("Erreur inode\n");
-    } else {
-
-        int direct_index = (int) floor(offset / 4096);
-        union fs_block temp_block;
-
-        while (direct_index < 5 && total_wrote < length) {
-            if (inode.direct[direct_index] == 0) {
-                int index = get_bloc();
-                if (index == -1) {
-                    printf("Taille insuffisante");
-                    return -1;
-                }
-                inode.direct[direct_index] = index;
-                bitmap[index] = 1;
-            }
-
-            int chunk = 4096;
-            if (chunk + total_wrote > length)
-                chunk = length - total_wrote;
-
-            strncpy(temp_block.data, data, chunk);
-            data += chunk;
-
-            disque_write(inode.direct[direct_index], temp_block.data);
-            inode.size += chunk;
-
-            total_wrote += chunk;
-            direct_index++;
-        }
-
-        if (total_wrote < length) {
-
-            //indirect block
-            union fs_block ind_block;
-
-            if (inode.indirect == 0) {
-                int index = get_bloc();
-                if (index == -1) {
-                    printf("Taille insuffisante");
-                    return -1;
-                }
-                inode.indirect = index;
-                bitmap[index] = 1;
-            }
-
-            disque_read(inode.indirect, ind_block.data);
-
-            for (int indirect_block = 0; total_wrote < length; indirect_block++) {
-                if (ind_block.pointers[indirect_block] == 0) {
-                    int index = get_bloc();
-                    if (index == -1) {
-                        printf("Taille insuffisante");
-                        return -1;
-                    }
-                    inode.direct[direct_index] = index;
-                }
-
-                int chunk = 4096;
-                if (chunk + total_wrote > length)
-                    chunk = length - total_wrote;
-
-                strncpy(temp_block.data, data, chunk);
-                data += chunk;
+// Initialise en arrière-plan les groupes que personne n'a encore touchés
+static void *lazy_worker(void *arg) {
+    struct sgf_mount *fs = arg;
+    for (int group = 0; group < fs->sb.super.ninodegroups && !fs->lazy_stop; group++) {
+        pthread_mutex_lock(&fs->lazy_lock);
+        if (LAZY_UNINIT(fs, group))
+            lazy_init_group(fs, group);
+        pthread_mutex_unlock(&fs->lazy_lock);
+    }
+    return NULL;
+}
 
-                disque_write(inode.direct[direct_index], temp_block.data);
-                inode.size += chunk;
+/**
+ * Réserve un bloc libre dans la bitmap. Chaque thread commence par un groupe différent
+ * pour que des allocations simultanées ne se disputent pas le même verrou.
+ *
+ * @return Numéro du bloc, marqué utilisé, -1 si le disque est plein
+ */
+int get_bloc(struct sgf_mount *fs) {
+    if (fs == NULL) {
+        printf("Vous devez monter le disque avant\n");
+        return -1;
+    }
 
-                total_wrote += chunk;
+    unsigned long self = (unsigned long) pthread_self();
+    int start = (int) ((self ^ (self >> 12)) % fs->ngroups);
+    for (int n = 0; n < fs->ngroups; n++) {
+        int group = (start + n) % fs->ngroups;
+        int end = (group + 1) * FS_ALLOC_GROUP;
+        if (end > fs->bitmap_size)
+            end = fs->bitmap_size;
+
+        pthread_mutex_lock(&fs->group_locks[group]);
+        // Premier bloc libre du groupe à partir de son indice
+        for (int i = fs->group_hint[group]; i < end; i++) {
+            if (fs->bitmap[i] == 0) {
+                fs->bitmap[i] = 1;
+                fs->group_hint[group] = i + 1;
+                pthread_mutex_unlock(&fs->group_locks[group]);
+                return i;
             }
         }
-        block.inode[inumber % 128] = inode;
-        disque_write(inode_block_index, block.data);
-        return total_wrote;
+        fs->group_hint[group] = end;
+        pthread_mutex_unlock(&fs->group_locks[group]);
     }
-
     return -1;
 }
 
-/**
- * Ecrit le répertoire sur le disque.
- *
- * @param dir Répertoire sur lequel écrire
- */
-void fs_write_dir_back(struct fs_directory dir) {
-    // Obtenir l'offset et l'index du bloc
-    int bloc_index = (dir.inum / DIR_PER_BLOCK);
-    int block_offset = (dir.inum % DIR_PER_BLOCK);
+// Marque un bloc utilisé dans la bitmap en mémoire
+static void bitmap_reserve(struct sgf_mount *fs, int bloc) {
+    int group = bloc / FS_ALLOC_GROUP;
+    pthread_mutex_lock(&fs->group_locks[group]);
+    fs->bitmap[bloc] = 1;
+    pthread_mutex_unlock(&fs->group_locks[group]);
+}
+
+// Rend un bloc au bitmap en mémoire
+static void bitmap_release(struct sgf_mount *fs, int bloc) {
+    int group = bloc / FS_ALLOC_GROUP;
+    pthread_mutex_lock(&fs->group_locks[group]);
+    fs->bitmap[bloc] = 0;
+    if (bloc < fs->group_hint[group] && bloc >= fs->sb.super.datastart)
+        fs->group_hint[group] = bloc;
+    pthread_mutex_unlock(&fs->group_locks[group]);
+}
 
-    // Lire le bloc
-    union fs_block block0, block;
-    disque_read(0, block0.data);
-    disque_read(block0.super.nblocks - 1 - bloc_index, block.data);
-    block.directories[block_offset] = dir;
+static void freelist_add(struct fs_freelist *fl, int bloc) {
+    if (fl->count == fl->capacity) {
+        fl->capacity = fl->capacity ? fl->capacity * 2 : 64;
+        fl->blocs = realloc(fl->blocs, fl->capacity * sizeof(int));
+    }
+    fl->blocs[fl->count++] = bloc;
+}
 
-    // Ecire le Dirblock
-    disque_write(block0.super.nblocks - 1 - bloc_index, block.data);
+static int compare_int(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
 }
 
 /**
- * Trouve une entrée valide avec le même nom.
+ * Libère les blocs du lot : les bits de la bitmap sont effacés dans l'ordre
+ * et chaque plage contiguë est signalée une seule fois au disque.
  *
- * @param dir Répertoire de recherche
- * @param name Nom du fichier/répertoire
- * @return décalage dans la table. -1 en cas d'erreur
+ * @param fl Lot de blocs, vidé au retour
  */
-int fs_dir_lookup(struct fs_directory dir, char name[]) {
-    int offset = 0;
-    for (; offset < ENTRIES_PER_DIR; offset++) {
-        if (
-                (dir.table[offset].isvalid == 1) &&
-                (streq(dir.table[offset].name, name))) {
-            break;
-        }
+static void freelist_release(struct sgf_mount *fs, struct fs_freelist *fl) {
+    if (fl->count == 0) {
+        return;
     }
-    if (offset == ENTRIES_PER_DIR) {
-        return -1;
+    qsort(fl->blocs, fl->count, sizeof(int), compare_int);
+
+    int i = 0;
+    while (i < fl->count) {
+        int j = i;
+        while (j + 1 < fl->count && fl->blocs[j + 1] == fl->blocs[j] + 1)
+            j++;
+        // La plage est signalée avant d'être rendue, un bloc réalloué entre temps serait effacé
+        for (int bloc = fl->blocs[i]; bloc <= fl->blocs[j]; bloc++)
+            batch_forget(fs, bloc);
+        disque_liberer(fs->disk, fl->blocs[i], fl->blocs[j] - fl->blocs[i] + 1);
+        for (int bloc = fl->blocs[i]; bloc <= fl->blocs[j]; bloc++)
+            bitmap_release(fs, bloc);
+        i = j + 1;
     }
 
-    return offset;
+    free(fl->blocs);
+    fl->blocs = NULL;
+    fl->count = 0;
+    fl->capacity = 0;
 }
+
 /**
- * Ajoute un répertoire
+ * Libère les blocs du lot. Avec un journal, les métadonnées sur disque peuvent encore les
+ * désigner : ils restent réservés jusqu'à la validation de la transaction qui les libère.
  *
- * @param dir Répertoire dans lequel l'entrée doit être ajoutée
- * @param inum Numéro d'inode
- * @param type type = 1 pour fichier , type = 0 pour répertoire
- * @param name Nom du fichier/répertoire
- * @return Répertoire avec une entrée ajoutée ou avec un bit valide mis à 0 en cas d'erreur.
+ * @param fl Lot de blocs, vidé au retour
  */
-struct fs_directory fs_add_dir_entry(struct fs_directory dir, int inum, int type, char name[]) {
-    struct fs_directory tempdir = dir;
-    int idx = 0;
-    for (; idx < ENTRIES_PER_DIR; idx++) {
-        if (tempdir.table[idx].isvalid == 0) {
-            break;
-        }
+static void freelist_commit(struct sgf_mount *fs, struct fs_freelist *fl) {
+    struct fs_journal *j = &fs->journal;
+    if (!j->running) {
+        freelist_release(fs, fl);
+        return;
     }
+    for (int i = 0; i < fl->count; i++)
+        batch_forget(fs, fl->blocs[i]);
+    pthread_mutex_lock(&j->lock);
+    for (int i = 0; i < fl->count; i++)
+        freelist_add(&j->freed, fl->blocs[i]);
+    pthread_mutex_unlock(&j->lock);
+
+    free(fl->blocs);
+    fl->blocs = NULL;
+    fl->count = 0;
+    fl->capacity = 0;
+}
 
-    // Vérification répertoire trouvé
-    if (idx == ENTRIES_PER_DIR) {
-        printf("Répertoire introuvable\n");
-        tempdir.isvalid = 0;
-        return tempdir;
-    }
+// Libère un seul bloc
+static void bloc_free(struct sgf_mount *fs, int bloc) {
+    struct fs_freelist fl = {0};
+    freelist_add(&fl, bloc);
+    freelist_commit(fs, &fl);
+}
 
-    // Emplacement pour répertoire libre trouvé, ajouter le nouveau à la table
-    tempdir.table[idx].inum = inum;
-    tempdir.table[idx].type = type;
-    tempdir.table[idx].isvalid = 1;
-    strcpy(tempdir.table[idx].name, name);
+// Accès aux pointeurs de blocs d'un inode, chaque bloc de pointeurs n'est lu qu'une seule fois
+struct fs_map {
+    struct fs_inode *inode;
+    union fs_block ind;   // Bloc indirect
+    int ind_loaded;
+    int ind_dirty;
+    union fs_block dind;  // Bloc doublement indirect
+    int dind_loaded;
+    int dind_dirty;
+    union fs_block leaf;  // Bloc de pointeurs désigné par le bloc doublement indirect
+    int leaf_bloc;
+    int leaf_dirty;
+};
+
+static void map_init(struct fs_map *map, struct fs_inode *inode) {
+    map->inode = inode;
+    map->ind_loaded = 0;
+    map->ind_dirty = 0;
+    map->dind_loaded = 0;
+    map->dind_dirty = 0;
+    map->leaf_bloc = 0;
+    map->leaf_dirty = 0;
+}
 
-    return tempdir;
+// Alloue un bloc de pointeurs vide
+static int map_new_bloc(struct sgf_mount *fs, union fs_block *blk) {
+    int bloc = get_bloc(fs);
+    if (bloc == -1) {
+        return 0;
+    }
+    memset(blk->data, 0, BLOCK_SIZE);
+    return bloc;
 }
 
 /**
- * Lit le répertoire à partir du décalage du Dirent
+ * Charge le bloc de pointeurs de second niveau couvrant l'index
  *
- * @param offset Décalage de la table qui doit être lue.
- * @return Retourne le répertoire avec bit valide, un bit=0 en cas d'erreur.
+ * @param map Accès aux pointeurs de l'inode
+ * @param index Index du bloc dans le fichier, au-delà des pointeurs indirects
+ * @param alloc Allouer les blocs de pointeurs manquants
+ * @return vrai si le bloc est chargé dans map->leaf
  */
-struct fs_directory fs_read_dir_from_offset(int offset) {
-    if (
-            (offset < 0) ||
-            (offset >= ENTRIES_PER_DIR) ||
-            (curr_dir.table[offset].isvalid == 0) ||
-            (curr_dir.table[offset].type != 0)) {
-        struct fs_directory temp;
-        temp.isvalid = 0;
-        return temp;
+static int map_leaf(struct sgf_mount *fs, struct fs_map *map, int index, int alloc) {
+    int l1 = (index - POINTERS_PER_INODE - POINTERS_PER_BLOCK) / POINTERS_PER_BLOCK;
+
+    if (map->inode->dindirect == 0) {
+        if (!alloc || !(map->inode->dindirect = map_new_bloc(fs, &map->dind))) {
+            return 0;
+        }
+        map->dind_loaded = 1;
+        map->dind_dirty = 1;
+    } else if (!map->dind_loaded) {
+        bloc_read(fs, map->inode->dindirect, map->dind.data);
+        map->dind_loaded = 1;
     }
 
-    // Obtenir l'offset et l'index
-    int inum = curr_dir.table[offset].inum;
-    int bloc_index = (inum / DIR_PER_BLOCK);
-    int block_offset = (inum % DIR_PER_BLOCK);
+    int leaf = map->dind.pointers[l1];
+    if (leaf == map->leaf_bloc && leaf != 0) {
+        return 1;
+    }
+    if (map->leaf_dirty) {
+        bloc_write(fs, map->leaf_bloc, map->leaf.data);
+        map->leaf_dirty = 0;
+    }
 
-    // lire le Block
-    union fs_block block0, blk;
-    disque_read(0, block0.data);
-    disque_read(block0.super.nblocks - 1 - bloc_index, blk.data);
-    return (blk.directories[block_offset]);
+    if (leaf == 0) {
+        if (!alloc || !(leaf = map_new_bloc(fs, &map->leaf))) {
+            map->leaf_bloc = 0;
+            return 0;
+        }
+        map->dind.pointers[l1] = leaf;
+        map->dind_dirty = 1;
+        map->leaf_dirty = 1;
+    } else {
+        bloc_read(fs, leaf, map->leaf.data);
+    }
+    map->leaf_bloc = leaf;
+    return 1;
 }
 
 /**
- * Lister tous les Dirent curr_dir.
+ * Renvoie le pointeur du bloc de données d'index donné dans le fichier
  *
- * @return vrai en cas de succès, faux en cas d'échec
+ * @param map Accès aux pointeurs de l'inode
+ * @param index Index du bloc dans le fichier
+ * @return Numéro de bloc, référence de fragment si négatif, 0 si aucun bloc
  */
-int fs_ls() {
-    if (bitmap == NULL) {
-        printf("Disque non monté\n");
+static int map_get(struct sgf_mount *fs, struct fs_map *map, int index) {
+    if (index < POINTERS_PER_INODE) {
+        return map->inode->direct[index];
+    }
+    if (index >= MAX_FILE_BLOCKS) {
+        return 0;
+    }
+    if (index >= POINTERS_PER_INODE + POINTERS_PER_BLOCK) {
+        if (!map_leaf(fs, map, index, 0)) {
+            return 0;
+        }
+        return map->leaf.pointers[(index - POINTERS_PER_INODE - POINTERS_PER_BLOCK) % POINTERS_PER_BLOCK];
+    }
+    if (map->inode->indirect == 0) {
+        return 0;
+    }
+    if (!map->ind_loaded) {
+        bloc_read(fs, map->inode->indirect, map->ind.data);
+        map->ind_loaded = 1;
+    }
+    return map->ind.pointers[index - POINTERS_PER_INODE];
+}
+
+/**
+ * Modifie le pointeur du bloc de données d'index donné, alloue les blocs de pointeurs si besoin
+ *
+ * @return vrai en cas de succès, faux si le fichier ne peut pas atteindre cet index
+ */
+static int map_set(struct sgf_mount *fs, struct fs_map *map, int index, int ptr) {
+    if (index < POINTERS_PER_INODE) {
+        map->inode->direct[index] = ptr;
+        return 1;
+    }
+    if (index >= MAX_FILE_BLOCKS) {
+        return 0;
+    }
+
+    if (index >= POINTERS_PER_INODE + POINTERS_PER_BLOCK) {
+        if (!map_leaf(fs, map, index, ptr != 0)) {
+            return ptr == 0;
+        }
+        map->leaf.pointers[(index - POINTERS_PER_INODE - POINTERS_PER_BLOCK) % POINTERS_PER_BLOCK] = ptr;
+        map->leaf_dirty = 1;
+        return 1;
+    }
+
+    if (map->inode->indirect == 0) {
+        if (ptr == 0) {
+            return 1;
+        }
+        if (!(map->inode->indirect = map_new_bloc(fs, &map->ind))) {
+            return 0;
+        }
+        map->ind_loaded = 1;
+    } else if (!map->ind_loaded) {
+        bloc_read(fs, map->inode->indirect, map->ind.data);
+        map->ind_loaded = 1;
+    }
+
+    map->ind.pointers[index - POINTERS_PER_INODE] = ptr;
+    map->ind_dirty = 1;
+    return 1;
+}
+
+// Écrit les blocs de pointeurs modifiés
+static void map_flush(struct sgf_mount *fs, struct fs_map *map) {
+    if (map->ind_dirty) {
+        bloc_write(fs, map->inode->indirect, map->ind.data);
+        map->ind_dirty = 0;
+    }
+    if (map->dind_dirty) {
+        bloc_write(fs, map->inode->dindirect, map->dind.data);
+        map->dind_dirty = 0;
+    }
+    if (map->leaf_dirty) {
+        bloc_write(fs, map->leaf_bloc, map->leaf.data);
+        map->leaf_dirty = 0;
+    }
+}
+
+/**
+ * Regroupe les fragments au début de la zone de données du bloc.
+ * Les inodes désignent un emplacement et non une position, ils restent valides.
+ *
+ * @param tb Bloc de fragments
+ * @return Fin de la zone occupée
+ */
+static int tail_compact(struct fs_tailblock *tb) {
+    char data[TAIL_DATA];
+    int end = 0;
+
+    for (int i = 0; i < TAIL_SLOTS; i++) {
+        if (tb->slots[i].inum != 0) {
+            memcpy(data + end, tb->data + tb->slots[i].offset, tb->slots[i].length);
+            tb->slots[i].offset = end;
+            end += tb->slots[i].length;
+        }
+    }
+    memcpy(tb->data, data, end);
+    return end;
+}
+
+/**
+ * Range la fin d'un fichier dans un bloc de fragments partagé avec d'autres fichiers
+ *
+ * @param inumber Inode propriétaire du fragment
+ * @param data Contenu de la fin du fichier
+ * @param length Taille du fragment (au plus TAIL_MAX)
+ * @return Référence du fragment, 0 s'il n'y a plus de place
+ */
+static int tail_alloc(struct sgf_mount *fs, int inumber, const char *data, int length) {
+    int bloc = 0;
+    pthread_mutex_lock(&fs->tail_lock);
+
+    // Le bloc courant d'abord, puis les blocs ayant récupéré de la place
+    if (fs->tail_courant > 0 && fs->tails[fs->tail_courant].libre >= length && fs->tails[fs->tail_courant].slots > 0) {
+        bloc = fs->tail_courant;
+    } else if (fs->tail_recycle) {
+        for (int i = 0; i < fs->bitmap_size; i++) {
+            if (fs->tails[i].libre >= length && fs->tails[i].slots > 0) {
+                bloc = i;
+                break;
+            }
+        }
+        if (bloc == 0) {
+            fs->tail_recycle = 0;
+        }
+    }
+
+    union fs_block blk;
+    if (bloc == 0) {
+        bloc = get_bloc(fs);
+        if (bloc == -1) {
+            pthread_mutex_unlock(&fs->tail_lock);
+            return 0;
+        }
+        memset(blk.data, 0, BLOCK_SIZE);
+        blk.tail.magic = TAIL_MAGIC;
+        fs->tails[bloc].libre = TAIL_DATA;
+        fs->tails[bloc].slots = TAIL_SLOTS;
+    } else {
+        bloc_read(fs, bloc, blk.data);
+    }
+    fs->tail_courant = bloc;
+
+    // Trouver un emplacement libre et la fin de la zone occupée
+    int slot = -1;
+    int end = 0;
+    for (int i = 0; i < TAIL_SLOTS; i++) {
+        struct fs_tailslot *s = &blk.tail.slots[i];
+        if (s->inum == 0) {
+            if (slot == -1)
+                slot = i;
+        } else if (s->offset + s->length > end) {
+            end = s->offset + s->length;
+        }
+    }
+    if (end + length > (int) TAIL_DATA) {
+        end = tail_compact(&blk.tail);
+    }
+
+    blk.tail.slots[slot].inum = inumber;
+    blk.tail.slots[slot].offset = end;
+    blk.tail.slots[slot].length = length;
+    blk.tail.nused++;
+    memcpy(blk.tail.data + end, data, length);
+    bloc_write(fs, bloc, blk.data);
+
+    fs->tails[bloc].libre -= length;
+    fs->tails[bloc].slots--;
+    pthread_mutex_unlock(&fs->tail_lock);
+
+    return TAIL_REF(bloc, slot);
+}
+
+/**
+ * Copie une partie d'un fragment dans le tampon
+ *
+ * @param ref Référence du fragment
+ * @param data Data buffer
+ * @param start Décalage dans le fragment
+ * @param length Nombre d'octets à copier
+ */
+static void tail_read(struct sgf_mount *fs, int ref, char *data, int start, int length) {
+    union fs_block blk;
+    pthread_mutex_lock(&fs->tail_lock);
+    bloc_read(fs, TAIL_BLOC(ref), blk.data);
+    pthread_mutex_unlock(&fs->tail_lock);
+
+    struct fs_tailslot s = blk.tail.slots[TAIL_SLOT(ref)];
+    if (start + length > s.length)
+        length = s.length - start;
+    if (length > 0)
+        memcpy(data, blk.tail.data + s.offset + start, length);
+}
+
+/**
+ * Libère l'emplacement d'un fragment. Un bloc de fragments vide est rendu à l'allocateur.
+ *
+ * @param ref Référence du fragment
+ * @param fl Lot recevant le bloc vide, NULL pour le libérer seul
+ */
+static void tail_free(struct sgf_mount *fs, int ref, struct fs_freelist *fl) {
+    int bloc = TAIL_BLOC(ref);
+    union fs_block blk;
+    pthread_mutex_lock(&fs->tail_lock);
+    bloc_read(fs, bloc, blk.data);
+
+    struct fs_tailslot *s = &blk.tail.slots[TAIL_SLOT(ref)];
+    fs->tails[bloc].libre += s->length;
+    fs->tails[bloc].slots++;
+    s->inum = 0;
+    s->length = 0;
+    blk.tail.nused--;
+
+    if (blk.tail.nused == 0) {
+        if (fl)
+            freelist_add(fl, bloc);
+        else
+            bloc_free(fs, bloc);
+        fs->tails[bloc].libre = -1;
+        fs->tails[bloc].slots = 0;
+        if (fs->tail_courant == bloc)
+            fs->tail_courant = 0;
+        pthread_mutex_unlock(&fs->tail_lock);
+        return;
+    }
+
+    bloc_write(fs, bloc, blk.data);
+    if (bloc != fs->tail_courant)
+        fs->tail_recycle = 1;
+    pthread_mutex_unlock(&fs->tail_lock);
+}
+
+/**
+ * Réduit la taille d'un fragment sans le déplacer
+ *
+ * @param ref Référence du fragment
+ * @param length Nouvelle taille
+ */
+static void tail_resize(struct sgf_mount *fs, int ref, int length) {
+    int bloc = TAIL_BLOC(ref);
+    union fs_block blk;
+    pthread_mutex_lock(&fs->tail_lock);
+    bloc_read(fs, bloc, blk.data);
+
+    struct fs_tailslot *s = &blk.tail.slots[TAIL_SLOT(ref)];
+    if (length < s->length) {
+        fs->tails[bloc].libre += s->length - length;
+        s->length = length;
+        bloc_write(fs, bloc, blk.data);
+    }
+    pthread_mutex_unlock(&fs->tail_lock);
+}
+
+/**
+ * Remplace la fin d'un fichier rangée en fragment par un bloc entier.
+ * Le bloc est alloué mais pas écrit, son contenu est renvoyé dans le tampon.
+ *
+ * @param map Accès aux pointeurs de l'inode
+ * @param index Index du bloc de la fin du fichier
+ * @param data Tampon de BLOCK_SIZE octets recevant le contenu du bloc
+ * @return Numéro du bloc alloué, -1 s'il n'y a plus de place
+ */
+static int tail_unpack(struct sgf_mount *fs, struct fs_map *map, int index, char *data) {
+    int ref = map_get(fs, map, index);
+    int bloc = get_bloc(fs);
+    if (bloc == -1) {
+        return -1;
+    }
+
+    memset(data, 0, BLOCK_SIZE);
+    tail_read(fs, ref, data, 0, BLOCK_SIZE);
+    tail_free(fs, ref, NULL);
+    map_set(fs, map, index, bloc);
+    return bloc;
+}
+
+// Vérifie si le tampon ne contient que des zéros
+static int bloc_nul(const char *data, int length) {
+    for (int i = 0; i < length; i++) {
+        if (data[i] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Retire de l'inode les blocs situés au-delà de la nouvelle taille et les ajoute au lot.
+ * Le dernier bloc conservé est rangé en fragment s'il est assez petit, sinon sa fin est effacée.
+ *
+ * @param inumber Numéro de l'inode
+ * @param inode Inode à réduire, modifié en mémoire
+ * @param newsize Nouvelle taille (inférieure ou égale à la taille actuelle)
+ * @param fl Lot des blocs à libérer
+ */
+static void inode_truncate(struct sgf_mount *fs, int inumber, struct fs_inode *inode, int newsize, struct fs_freelist *fl) {
+    struct fs_map map;
+    map_init(&map, inode);
+
+    int old_blocks = (inode->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int keep = (newsize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // Premier bloc de second niveau entièrement libéré
+    int first_leaf = 0;
+    if (keep > POINTERS_PER_INODE + POINTERS_PER_BLOCK)
+        first_leaf = (keep - POINTERS_PER_INODE - POINTERS_PER_BLOCK + POINTERS_PER_BLOCK - 1) / POINTERS_PER_BLOCK;
+
+    for (int index = keep; index < old_blocks; index++) {
+        int ptr = map_get(fs, &map, index);
+        if (ptr > 0) {
+            freelist_add(fl, ptr);
+        } else if (ptr < 0) {
+            tail_free(fs, ptr, fl);
+        }
+
+        // Seuls les blocs de pointeurs conservés sont mis à jour
+        if (index < POINTERS_PER_INODE) {
+            inode->direct[index] = 0;
+        } else if (ptr != 0 && index < POINTERS_PER_INODE + POINTERS_PER_BLOCK) {
+            if (keep > POINTERS_PER_INODE)
+                map_set(fs, &map, index, 0);
+        } else if (ptr != 0 && (index - POINTERS_PER_INODE - POINTERS_PER_BLOCK) / POINTERS_PER_BLOCK < first_leaf) {
+            map_set(fs, &map, index, 0);
+        }
+    }
+
+    // Les blocs de pointeurs qui ne servent plus
+    if (keep <= POINTERS_PER_INODE && inode->indirect != 0) {
+        freelist_add(fl, inode->indirect);
+        inode->indirect = 0;
+        map.ind_dirty = 0;
+    }
+    if (inode->dindirect != 0) {
+        if (!map.dind_loaded) {
+            bloc_read(fs, inode->dindirect, map.dind.data);
+            map.dind_loaded = 1;
+        }
+        for (int l1 = first_leaf; l1 < POINTERS_PER_BLOCK; l1++) {
+            int leaf = map.dind.pointers[l1];
+            if (leaf != 0) {
+                freelist_add(fl, leaf);
+                if (map.leaf_bloc == leaf) {
+                    map.leaf_bloc = 0;
+                    map.leaf_dirty = 0;
+                }
+                map.dind.pointers[l1] = 0;
+                map.dind_dirty = 1;
+            }
+        }
+        if (first_leaf == 0) {
+            freelist_add(fl, inode->dindirect);
+            inode->dindirect = 0;
+            map.dind_dirty = 0;
+        }
+    }
+
+    int length = newsize % BLOCK_SIZE;
+    if (length > 0 && newsize < inode->size) {
+        int ptr = map_get(fs, &map, keep - 1);
+        if (ptr < 0) {
+            tail_resize(fs, ptr, length);
+        } else if (ptr > 0) {
+            union fs_block blk;
+            bloc_read(fs, ptr, blk.data);
+
+            int ref = 0;
+            if (length <= TAIL_MAX)
+                ref = tail_alloc(fs, inumber, blk.data, length);
+            if (ref != 0) {
+                map_set(fs, &map, keep - 1, ref);
+                freelist_add(fl, ptr);
+            } else {
+                memset(blk.data + length, 0, BLOCK_SIZE - length);
+                data_write(fs, ptr, blk.data);
+            }
+        }
+    }
+
+    map_flush(fs, &map);
+    inode->size = newsize;
+}
+
+// Enregistrement à une position d'un bloc de répertoire
+#define DIRREC_AT(blk, off) ((struct fs_dirrec *) ((blk)->data + (off)))
+
+/**
+ * Position de l'enregistrement suivant dans un bloc de répertoire
+ *
+ * @return BLOCK_SIZE en fin de bloc ou si la longueur est incohérente
+ */
+static int dirblk_next(union fs_block *blk, int off) {
+    int len = DIRREC_AT(blk, off)->rec_len;
+    if (len < DIRREC_LEN(0) || off + len > BLOCK_SIZE) {
+        return BLOCK_SIZE;
+    }
+    return off + len;
+}
+
+/**
+ * Initialise un bloc de répertoire vide : un seul enregistrement libre couvre le bloc
+ */
+static void dirblk_init(union fs_block *blk) {
+    memset(blk->data, 0, BLOCK_SIZE);
+    DIRREC_AT(blk, 0)->rec_len = BLOCK_SIZE;
+}
+
+static void dirrec_decode(struct fs_dirrec *rec, struct fs_dirent *entry) {
+    entry->type = rec->type;
+    entry->isvalid = 1;
+    entry->inum = rec->inum;
+    memcpy(entry->name, rec->name, rec->name_len);
+    entry->name[rec->name_len] = '\0';
+}
+
+/**
+ * Cherche un nom dans un bloc de répertoire
+ *
+ * @param blk Bloc de répertoire
+ * @param name Nom cherché
+ * @param entry Reçoit l'entrée trouvée, peut être NULL
+ * @return Position de l'enregistrement dans le bloc, -1 si absent
+ */
+static int dirblk_find(union fs_block *blk, const char *name, struct fs_dirent *entry) {
+    size_t len = strlen(name);
+    for (int off = 0; off < BLOCK_SIZE; off = dirblk_next(blk, off)) {
+        struct fs_dirrec *rec = DIRREC_AT(blk, off);
+        if (rec->inum != 0 && rec->name_len == len && memcmp(rec->name, name, len) == 0) {
+            if (entry)
+                dirrec_decode(rec, entry);
+            return off;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Lit l'entrée valide qui commence à une position d'un bloc de répertoire
+ *
+ * @return vrai si un enregistrement valide commence à cette position
+ */
+static int dirblk_get(union fs_block *blk, int pos, struct fs_dirent *entry) {
+    int off = 0;
+    while (off < pos)
+        off = dirblk_next(blk, off);
+    if (off != pos || pos >= BLOCK_SIZE || DIRREC_AT(blk, off)->inum == 0) {
+        return 0;
+    }
+    dirrec_decode(DIRREC_AT(blk, off), entry);
+    return 1;
+}
+
+/**
+ * Place une entrée dans la place inutilisée d'un enregistrement du bloc
+ *
+ * @param blk Bloc de répertoire
+ * @param entry Entrée à ajouter, son nom fait moins de NAMESIZE octets
+ * @return Position du nouvel enregistrement, -1 si le bloc n'a plus assez de place
+ */
+static int dirblk_add(union fs_block *blk, struct fs_dirent *entry) {
+    int len = strlen(entry->name);
+    int need = DIRREC_LEN(len);
+    for (int off = 0; off < BLOCK_SIZE; off = dirblk_next(blk, off)) {
+        struct fs_dirrec *rec = DIRREC_AT(blk, off);
+        int used = rec->inum != 0 ? DIRREC_LEN(rec->name_len) : 0;
+        if (rec->rec_len - used < need)
+            continue;
+
+        // Couper l'enregistrement : sa place inutilisée devient le nouvel enregistrement
+        if (used) {
+            struct fs_dirrec *next = DIRREC_AT(blk, off + used);
+            next->rec_len = rec->rec_len - used;
+            rec->rec_len = used;
+            rec = next;
+            off += used;
+        }
+        rec->inum = entry->inum;
+        rec->name_len = len;
+        rec->type = entry->type;
+        memcpy(rec->name, entry->name, len);
+        return off;
+    }
+    return -1;
+}
+
+/**
+ * Libère l'enregistrement à une position du bloc, sa place rejoint l'enregistrement précédent
+ *
+ * @param blk Bloc de répertoire
+ * @param pos Position de l'enregistrement
+ * @param entry Reçoit l'entrée libérée
+ * @return vrai si un enregistrement valide commençait à cette position
+ */
+static int dirblk_erase(union fs_block *blk, int pos, struct fs_dirent *entry) {
+    int prev = -1, off = 0;
+    while (off < pos) {
+        prev = off;
+        off = dirblk_next(blk, off);
+    }
+    if (off != pos || pos >= BLOCK_SIZE || DIRREC_AT(blk, off)->inum == 0) {
+        return 0;
+    }
+
+    struct fs_dirrec *rec = DIRREC_AT(blk, off);
+    dirrec_decode(rec, entry);
+    if (prev == -1)
+        rec->inum = 0;
+    else
+        DIRREC_AT(blk, prev)->rec_len += rec->rec_len;
+    return 1;
+}
+
+/**
+ * Initialise le premier bloc d'un répertoire avec ses entrées "." et ".."
+ */
+static void dirblk_init_dots(union fs_block *blk, int inum, int parent_inum) {
+    struct fs_dirent temp;
+    memset(&temp, 0, sizeof(temp));
+    temp.type = 0;
+    temp.isvalid = 1;
+
+    dirblk_init(blk);
+    temp.inum = inum;
+    strcpy(temp.name, ".");
+    dirblk_add(blk, &temp);
+    temp.inum = parent_inum;
+    strcpy(temp.name, "..");
+    dirblk_add(blk, &temp);
+}
+
+/**
+ * Nombre de mots de 64 bits des bitmaps sauvés : blocs utilisés, blocs de fragments puis inodes
+ */
+static int map_words(struct fs_superblock *super) {
+    return 2 * ((super->nblocks + 63) / 64) + super->ninodes / 64;
+}
+
+/**
+ * Range les bitmaps des blocs utilisés, des blocs de fragments et des inodes à la suite,
+ * telles qu'elles sont écrites dans la zone des bitmaps
+ *
+ * @param bits mapblocks blocs mis à zéro
+ */
+static void map_build(struct sgf_mount *fs, uint64_t *bits) {
+    int nblocks = fs->sb.super.nblocks;
+    int wb = (nblocks + 63) / 64;
+    int words = map_words(&fs->sb.super);
+
+    for (int i = 0; i < nblocks; i++) {
+        if (fs->bitmap[i])
+            bits[i / 64] |= (uint64_t) 1 << (i % 64);
+        if (fs->tails[i].libre != -1)
+            bits[wb + i / 64] |= (uint64_t) 1 << (i % 64);
+    }
+    memcpy(&bits[2 * wb], fs->inode_bitmap, (words - 2 * wb) * sizeof(uint64_t));
+}
+
+/**
+ * Sauve les bitmaps dans la zone des bitmaps
+ *
+ * @return vrai en cas de succès
+ */
+static int map_save(struct sgf_mount *fs) {
+    uint64_t *bits = calloc(fs->sb.super.mapblocks, BLOCK_SIZE);
+    if (bits == NULL) {
+        return 0;
+    }
+    map_build(fs, bits);
+
+    for (int k = 0; k < fs->sb.super.mapblocks; k++)
+        bloc_write(fs, fs->sb.super.mapstart + k, (char *) bits + k * BLOCK_SIZE);
+    free(bits);
+    return 1;
+}
+
+/**
+ * Relit les bitmaps sauvés au dernier démontage. Les blocs de fragments sont
+ * seulement repérés, leur remplissage est calculé par l'appelant.
+ *
+ * @return vrai en cas de succès
+ */
+static int map_load(struct sgf_mount *fs) {
+    int nblocks = fs->sb.super.nblocks;
+    int wb = (nblocks + 63) / 64;
+    int words = map_words(&fs->sb.super);
+    uint64_t *bits = malloc(fs->sb.super.mapblocks * BLOCK_SIZE);
+    if (bits == NULL) {
+        return 0;
+    }
+
+    for (int k = 0; k < fs->sb.super.mapblocks; k++)
+        bloc_read(fs, fs->sb.super.mapstart + k, (char *) bits + k * BLOCK_SIZE);
+
+    for (int i = 0; i < nblocks; i++) {
+        fs->bitmap[i] = (bits[i / 64] >> (i % 64)) & 1;
+        if ((bits[wb + i / 64] >> (i % 64)) & 1)
+            fs->tails[i].libre = 0;
+    }
+    memcpy(fs->inode_bitmap, &bits[2 * wb], (words - 2 * wb) * sizeof(uint64_t));
+    free(bits);
+    return 1;
+}
+
+// Position suivante dans la zone du journal, après l'en-tête
+static int journal_next(struct fs_journal *j, int pos) {
+    return pos + 1 < j->nblocks ? pos + 1 : 1;
+}
+
+#define JOURNAL_SUM_INIT 0xcbf29ce484222325ull
+
+// Ajoute un bloc et son numéro à la somme de contrôle d'une transaction
+static uint64_t journal_sum(uint64_t sum, int bloc, const char *data) {
+    const uint64_t *words = (const uint64_t *) data;
+    sum = (sum ^ (uint32_t) bloc) * 0x100000001b3ull;
+    for (int k = 0; k < BLOCK_SIZE / 8; k++)
+        sum = (sum ^ words[k]) * 0x100000001b3ull;
+    return sum;
+}
+
+/**
+ * Vide le journal : les transactions déjà reportées sur place sont rendues durables,
+ * puis l'en-tête désigne la position de la prochaine transaction.
+ * Doit être appelé avec flush_lock.
+ */
+static void journal_reset(struct sgf_mount *fs) {
+    struct fs_journal *j = &fs->journal;
+    union fs_block blk;
+    disque_sync(fs->disk);
+    memset(blk.data, 0, BLOCK_SIZE);
+    blk.jsuper.magic = JOURNAL_MAGIC;
+    blk.jsuper.seq = j->seq;
+    blk.jsuper.tail = j->head;
+    blk.jsuper.rescan = j->rescan;
+    disque_write(fs->disk, j->start, blk.data);
+    disque_sync(fs->disk);
+    j->used = 0;
+    if (j->logged != NULL)
+        memset(j->logged, 0, (fs->sb.super.nblocks + 63) / 64 * sizeof(uint64_t));
+}
+
+static void txn_free(struct fs_txn *t) {
+    free(t->blocs);
+    free(t->gens);
+    free(t->data);
+    free(t->freed.blocs);
+}
+
+/**
+ * Copie les blocs de la transaction ouverte : ceux du cache par numéro croissant, puis
+ * les blocs des bitmaps qui ont changé depuis la transaction précédente. Les blocs libérés
+ * par la transaction y sont comptés libres. Doit être appelé avec journal.lock, aucune
+ * opération n'étant en cours.
+ *
+ * @return vrai si la transaction a été copiée
+ */
+static int journal_capture(struct sgf_mount *fs, struct fs_txn *t) {
+    struct fs_journal *j = &fs->journal;
+    int ncached = __atomic_load_n(&fs->batch.count, __ATOMIC_ACQUIRE);
+    int mapblocks = fs->sb.super.mapblocks;
+    int capacity = ncached + mapblocks;
+    uint64_t *bits = calloc(mapblocks, BLOCK_SIZE);
+    t->blocs = malloc(capacity * sizeof(int));
+    t->gens = malloc(capacity * sizeof(unsigned long));
+    t->data = malloc((size_t) capacity * BLOCK_SIZE);
+    if (bits == NULL || t->blocs == NULL || t->gens == NULL || t->data == NULL) {
+        free(bits);
+        return 0;
+    }
+
+    int n = 0;
+    for (int i = 0; i < FS_CACHE_BUCKETS; i++) {
+        struct fs_bucket *b = &fs->batch.buckets[i];
+        pthread_mutex_lock(&b->lock);
+        for (struct fs_cached *c = b->head; c != NULL && n < ncached; c = c->next)
+            t->blocs[n++] = c->bloc;
+        pthread_mutex_unlock(&b->lock);
+    }
+    qsort(t->blocs, n, sizeof(int), compare_int);
+    for (int i = 0; i < n; i++) {
+        struct fs_bucket *b = BATCH_BUCKET(fs, t->blocs[i]);
+        pthread_mutex_lock(&b->lock);
+        struct fs_cached *c = *batch_find(b, t->blocs[i]);
+        memcpy(t->data + (size_t) i * BLOCK_SIZE, c->data.data, BLOCK_SIZE);
+        t->gens[i] = c->gen;
+        pthread_mutex_unlock(&b->lock);
+    }
+    t->ncached = n;
+
+    map_build(fs, bits);
+    for (int i = 0; i < j->freed.count; i++)
+        bits[j->freed.blocs[i] / 64] &= ~((uint64_t) 1 << (j->freed.blocs[i] % 64));
+    for (int k = 0; k < mapblocks; k++) {
+        char *blk = (char *) bits + (size_t) k * BLOCK_SIZE;
+        char *old = (char *) j->map + (size_t) k * BLOCK_SIZE;
+        if (memcmp(blk, old, BLOCK_SIZE) != 0) {
+            memcpy(old, blk, BLOCK_SIZE);
+            memcpy(t->data + (size_t) n * BLOCK_SIZE, blk, BLOCK_SIZE);
+            t->blocs[n] = fs->sb.super.mapstart + k;
+            t->gens[n++] = 0;
+        }
+    }
+    free(bits);
+    t->id = j->opened++;
+    t->count = n;
+    t->freed = j->freed;
+    j->freed = (struct fs_freelist) {0};
+    return 1;
+}
+
+/**
+ * Écrit une transaction à la suite dans le journal et la rend durable
+ * par une seule synchronisation du disque. Doit être appelé avec flush_lock.
+ *
+ * @return vrai si la transaction a été journalisée, faux si elle dépasse la zone
+ */
+static int journal_log(struct sgf_mount *fs, struct fs_txn *t) {
+    struct fs_journal *j = &fs->journal;
+    int need = t->count + (t->count + JOURNAL_TAGS - 1) / JOURNAL_TAGS + 1;
+    if (need > j->nblocks - 1) {
+        return 0;
+    }
+    // Plus de place : les transactions précédentes sont rendues durables sur place
+    if (j->used + need > j->nblocks - 1)
+        journal_reset(fs);
+
+    union fs_block blk;
+    uint64_t sum = JOURNAL_SUM_INIT ^ j->seq;
+    int pos = j->head;
+    for (int i = 0; i < t->count; i += JOURNAL_TAGS) {
+        int count = t->count - i < JOURNAL_TAGS ? t->count - i : JOURNAL_TAGS;
+        memset(blk.data, 0, BLOCK_SIZE);
+        blk.jdesc.magic = JOURNAL_DESC;
+        blk.jdesc.seq = j->seq;
+        blk.jdesc.count = count;
+        memcpy(blk.jdesc.blocs, t->blocs + i, count * sizeof(int));
+        disque_write(fs->disk, j->start + pos, blk.data);
+        pos = journal_next(j, pos);
+        for (int k = i; k < i + count; k++) {
+            const char *data = t->data + (size_t) k * BLOCK_SIZE;
+            disque_write(fs->disk, j->start + pos, data);
+            sum = journal_sum(sum, t->blocs[k], data);
+            pos = journal_next(j, pos);
+        }
+    }
+    memset(blk.data, 0, BLOCK_SIZE);
+    blk.jcommit.magic = JOURNAL_COMMIT;
+    blk.jcommit.seq = j->seq;
+    blk.jcommit.count = t->count;
+    blk.jcommit.sum = sum;
+    disque_write(fs->disk, j->start + pos, blk.data);
+    disque_sync(fs->disk);
+
+    for (int i = 0; i < t->count; i++)
+        j->logged[t->blocs[i] / 64] |= (uint64_t) 1 << (t->blocs[i] % 64);
+    j->head = journal_next(j, pos);
+    j->used += need;
+    j->seq++;
+    return 1;
+}
+
+/**
+ * Reporte une transaction sur place. Un bloc du cache qui n'a pas été réécrit
+ * depuis sa copie en est retiré, les autres appartiennent à la transaction suivante.
+ */
+static void journal_checkpoint(struct sgf_mount *fs, struct fs_txn *t) {
+    for (int i = 0; i < t->count; i++)
+        disque_write(fs->disk, t->blocs[i], t->data + (size_t) i * BLOCK_SIZE);
+
+    for (int i = 0; i < t->ncached; i++) {
+        struct fs_bucket *b = BATCH_BUCKET(fs, t->blocs[i]);
+        pthread_mutex_lock(&b->lock);
+        struct fs_cached **p = batch_find(b, t->blocs[i]);
+        struct fs_cached *c = *p;
+        if (c != NULL && c->gen == t->gens[i]) {
+            *p = c->next;
+            free(c);
+            __atomic_sub_fetch(&fs->batch.count, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&b->lock);
+    }
+}
+
+/**
+ * Indique si un bloc libéré a une copie dans le journal. Réutilisé pour des données, qui
+ * ne sont pas journalisées, il serait écrasé par le rejeu de cette copie.
+ */
+static int journal_logged(struct fs_journal *j, const struct fs_freelist *fl) {
+    for (int i = 0; i < fl->count; i++)
+        if ((j->logged[fl->blocs[i] / 64] >> (fl->blocs[i] % 64)) & 1)
+            return 1;
+    return 0;
+}
+
+/**
+ * Valide la transaction ouverte. Les opérations en cours sont attendues et les nouvelles
+ * retenues le temps de copier ses blocs ; elle est ensuite journalisée et reportée sur
+ * place pendant que les opérations suivantes remplissent la transaction d'après.
+ * Doit être appelé avec flush_lock.
+ *
+ * @return Nombre de blocs de la transaction
+ */
+static int journal_commit_locked(struct sgf_mount *fs) {
+    struct fs_journal *j = &fs->journal;
+    struct fs_txn t = {0};
+    pthread_mutex_lock(&j->lock);
+    j->closing = 1;
+    while (j->active > 0)
+        pthread_cond_wait(&j->cond, &j->lock);
+    int captured = journal_capture(fs, &t);
+    j->closing = 0;
+    pthread_cond_broadcast(&j->cond);
+    pthread_mutex_unlock(&j->lock);
+
+    if (captured && t.count > 0) {
+        // Une transaction plus grande que le journal est écrite sur place sans lui, après que
+        // les précédentes sont devenues durables. L'en-tête demande la reconstruction des
+        // bitmaps jusqu'à ce que ses blocs le soient aussi
+        if (journal_log(fs, &t)) {
+            journal_checkpoint(fs, &t);
+        } else {
+            j->rescan = 1;
+            journal_reset(fs);
+            journal_checkpoint(fs, &t);
+            j->rescan = 0;
+            journal_reset(fs);
+        }
+    }
+    if (captured) {
+        j->durable = t.id;
+        // Les copies des blocs libérés ne doivent plus être rejouées avant qu'ils soient réutilisés
+        if (journal_logged(j, &t.freed))
+            journal_reset(fs);
+        freelist_release(fs, &t.freed);
+    }
+    txn_free(&t);
+    return t.count;
+}
+
+static int journal_commit(struct sgf_mount *fs) {
+    pthread_mutex_lock(&fs->batch.flush_lock);
+    int count = journal_commit_locked(fs);
+    pthread_mutex_unlock(&fs->batch.flush_lock);
+    return count;
+}
+
+/**
+ * Rend durables les opérations terminées avant l'appel. Les appels concurrents attendent
+ * la validation en cours puis partagent la suivante : une seule synchronisation du disque
+ * sert tous ceux qui attendaient.
+ *
+ * @return vrai en cas de succès
+ */
+static int journal_sync(struct sgf_mount *fs) {
+    struct fs_journal *j = &fs->journal;
+    pthread_mutex_lock(&j->lock);
+    unsigned long target = j->opened;
+    pthread_mutex_unlock(&j->lock);
+
+    pthread_mutex_lock(&fs->batch.flush_lock);
+    if (j->durable < target)
+        journal_commit_locked(fs);
+    int ok = j->durable >= target;
+    pthread_mutex_unlock(&fs->batch.flush_lock);
+    return ok;
+}
+
+// Valide la transaction ouverte toutes les FS_JOURNAL_DELAY ms, ou plus tôt si le cache se remplit
+static void *journal_worker(void *arg) {
+    struct sgf_mount *fs = arg;
+    struct fs_journal *j = &fs->journal;
+    pthread_mutex_lock(&j->lock);
+    while (!j->stop) {
+        if (!j->wanted) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += FS_JOURNAL_DELAY / 1000;
+            ts.tv_nsec += (FS_JOURNAL_DELAY % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&j->wake, &j->lock, &ts);
+            if (j->stop)
+                break;
+        }
+        j->wanted = 0;
+        pthread_mutex_unlock(&j->lock);
+        journal_commit(fs);
+        pthread_mutex_lock(&j->lock);
+    }
+    pthread_mutex_unlock(&j->lock);
+    return NULL;
+}
+
+/**
+ * Rejoue dans l'ordre les transactions complètes du journal, à partir de celle que désigne
+ * l'en-tête et jusqu'à la première dont le bloc de fin manque ou ne correspond pas
+ *
+ * @return Nombre de transactions rejouées, -1 si l'en-tête est illisible
+ */
+static int journal_replay(struct sgf_mount *fs) {
+    struct fs_journal *j = &fs->journal;
+    union fs_block blk;
+    disque_read(fs->disk, j->start, blk.data);
+    if (blk.jsuper.magic != JOURNAL_MAGIC || blk.jsuper.tail < 1 || blk.jsuper.tail >= j->nblocks) {
+        return -1;
+    }
+    unsigned int seq = blk.jsuper.seq;
+    int pos = blk.jsuper.tail;
+    int cap = j->nblocks - 1;
+    j->rescan = blk.jsuper.rescan != 0;
+    int *blocs = malloc(cap * sizeof(int));
+    int *where = malloc(cap * sizeof(int));
+    if (blocs == NULL || where == NULL) {
+        free(blocs);
+        free(where);
+        return -1;
+    }
+
+    int replayed = 0, scanned = 0;
+    for (;;) {
+        int count = 0, n = 0, p = pos, complete = 0;
+        uint64_t expected = 0;
+        while (scanned + n < cap) {
+            disque_read(fs->disk, j->start + p, blk.data);
+            p = journal_next(j, p);
+            n++;
+            if (blk.jdesc.magic == JOURNAL_DESC && blk.jdesc.seq == seq && blk.jdesc.count > 0
+                && blk.jdesc.count <= JOURNAL_TAGS && scanned + n + blk.jdesc.count < cap) {
+                for (int k = 0; k < blk.jdesc.count; k++) {
+                    blocs[count] = blk.jdesc.blocs[k];
+                    where[count++] = p;
+                    p = journal_next(j, p);
+                }
+                n += blk.jdesc.count;
+                continue;
+            }
+            complete = blk.jcommit.magic == JOURNAL_COMMIT && blk.jcommit.seq == seq && blk.jcommit.count == count;
+            expected = blk.jcommit.sum;
+            break;
+        }
+        if (!complete) {
+            break;
+        }
+
+        // Les copies sont vérifiées avant d'écrire quoi que ce soit sur place
+        uint64_t sum = JOURNAL_SUM_INIT ^ seq;
+        int valid = 1;
+        for (int k = 0; k < count; k++) {
+            if (blocs[k] <= 0 || blocs[k] >= fs->sb.super.nblocks
+                || (blocs[k] >= j->start && blocs[k] < j->start + j->nblocks))
+                valid = 0;
+            disque_read(fs->disk, j->start + where[k], blk.data);
+            sum = journal_sum(sum, blocs[k], blk.data);
+        }
+        if (!valid || sum != expected) {
+            break;
+        }
+        for (int k = 0; k < count; k++) {
+            disque_read(fs->disk, j->start + where[k], blk.data);
+            disque_write(fs->disk, blocs[k], blk.data);
+        }
+        replayed++;
+        seq++;
+        pos = p;
+        scanned += n;
+    }
+    free(blocs);
+    free(where);
+
+    j->seq = seq;
+    j->head = pos;
+    journal_reset(fs);
+    return replayed;
+}
+
+/**
+ * Ouvre le journal d'un montage. Après un arrêt brutal, ses transactions validées sont
+ * rejouées : les bitmaps sur disque sont alors à jour comme après un démontage propre,
+ * sauf si une transaction écrite sur place sans le journal a été interrompue.
+ *
+ * @param replay vrai si le disque n'a pas été démonté proprement
+ * @return vrai si les bitmaps sur disque sont à jour
+ */
+static int journal_open(struct sgf_mount *fs, int replay) {
+    struct fs_journal *j = &fs->journal;
+    j->start = fs->sb.super.journalstart;
+    j->nblocks = fs->sb.super.journalblocks;
+    j->seq = 1;
+    j->head = 1;
+    j->rescan = 0;
+    if (replay) {
+        int n = journal_replay(fs);
+        if (n > 0)
+            printf("Journal : %d transactions rejouées\n", n);
+        return n >= 0 && !j->rescan;
+    }
+    union fs_block blk;
+    disque_read(fs->disk, j->start, blk.data);
+    if (blk.jsuper.magic == JOURNAL_MAGIC && blk.jsuper.tail >= 1 && blk.jsuper.tail < j->nblocks) {
+        j->seq = blk.jsuper.seq;
+        j->head = blk.jsuper.tail;
+    }
+    return 1;
+}
+
+/**
+ * Démarre la journalisation, une fois les bitmaps en mémoire
+ *
+ * @param scanned vrai si les bitmaps ont été reconstruites : elles sont d'abord écrites
+ * @return vrai si le thread de validation tourne
+ */
+static int journal_start(struct sgf_mount *fs, int scanned) {
+    struct fs_journal *j = &fs->journal;
+    j->map = calloc(fs->sb.super.mapblocks, BLOCK_SIZE);
+    j->logged = calloc((fs->sb.super.nblocks + 63) / 64, sizeof(uint64_t));
+    if (j->map == NULL || j->logged == NULL) {
+        return 0;
+    }
+    if (scanned)
+        map_save(fs);
+    map_build(fs, j->map);
+    // Les bitmaps reconstruites sont durables avant que l'en-tête ne cesse de le demander
+    j->rescan = 0;
+    journal_reset(fs);
+
+    j->limit = (j->nblocks - 1) / 4 > 0 ? (j->nblocks - 1) / 4 : 1;
+    j->opened = 1;
+    j->durable = 0;
+    j->stop = 0;
+    if (thread_start(&j->thread, journal_worker, fs) != 0) {
+        return 0;
+    }
+    j->running = 1;
+    return 1;
+}
+
+// Arrête le thread de validation et valide la dernière transaction
+static void journal_stop(struct sgf_mount *fs) {
+    struct fs_journal *j = &fs->journal;
+    if (j->running) {
+        pthread_mutex_lock(&j->lock);
+        j->stop = 1;
+        pthread_cond_signal(&j->wake);
+        pthread_mutex_unlock(&j->lock);
+        pthread_join(j->thread, NULL);
+        journal_commit(fs);
+        j->running = 0;
+        journal_reset(fs);
+    }
+    free(j->map);
+    free(j->logged);
+    j->map = NULL;
+    j->logged = NULL;
+}
+
+// Accès aux champs partagés avec les lecteurs sans verrou
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+// Pointeur vers une mémoire initialisée avant sa publication
+#define READ_PTR(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define PUBLISH_PTR(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/**
+ * Commence la lecture d'une structure protégée par un compteur de séquence
+ *
+ * @return Valeur du compteur, impaire si une modification est en cours
+ */
+static unsigned int seq_read_begin(const unsigned int *seq) {
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+// Vérifie qu'aucune modification n'a eu lieu depuis seq_read_begin
+static int seq_read_valid(const unsigned int *seq, unsigned int start) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return !(start & 1) && __atomic_load_n(seq, __ATOMIC_RELAXED) == start;
+}
+
+// Rend le compteur impair, en attendant la fin d'une autre modification
+static void seq_write_begin(unsigned int *seq) {
+    unsigned int cur = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    while ((cur & 1) || !__atomic_compare_exchange_n(seq, &cur, cur + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        sched_yield();
+        cur = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_write_end(unsigned int *seq) {
+    __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Commence une lecture sans verrou : l'emplacement d'un lecteur reçoit l'époque courante,
+ * la mémoire retirée après ce moment n'est pas libérée avant epoch_exit
+ *
+ * @return Emplacement du lecteur
+ */
+static struct fs_reader *epoch_enter(struct sgf_mount *fs) {
+    unsigned long self = (unsigned long) pthread_self();
+    int start = (int) ((self ^ (self >> 12)) % FS_READERS);
+    for (int i = 0;; i = (i + 1) % FS_READERS) {
+        struct fs_reader *r = &fs->readers[(start + i) % FS_READERS];
+        unsigned long idle = 0;
+        unsigned long epoch = __atomic_load_n(&fs->epoch, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->epoch, __ATOMIC_RELAXED) == 0
+            && __atomic_compare_exchange_n(&r->epoch, &idle, epoch, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            return r;
+        }
+    }
+}
+
+static void epoch_exit(struct fs_reader *r) {
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Libère la mémoire retirée que plus aucune lecture en cours ne peut voir.
+ * Doit être appelé avec dircache_lock, ou sans aucun lecteur possible.
+ */
+static void epoch_reclaim(struct sgf_mount *fs) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long oldest = (unsigned long) -1;
+    for (int i = 0; i < FS_READERS; i++) {
+        unsigned long epoch = __atomic_load_n(&fs->readers[i].epoch, __ATOMIC_ACQUIRE);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    struct fs_retired **p = &fs->retired;
+    while (*p != NULL) {
+        struct fs_retired *r = *p;
+        if (r->epoch <= oldest) {
+            *p = r->next;
+            r->release(r->ptr);
+            free(r);
+            fs->nretired--;
+        } else {
+            p = &r->next;
+        }
+    }
+}
+
+/**
+ * Attend la fin des lectures sans verrou commencées avant l'appel
+ */
+static void epoch_synchronize(struct sgf_mount *fs) {
+    unsigned long epoch = __atomic_add_fetch(&fs->epoch, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < FS_READERS; i++) {
+        unsigned long e;
+        while ((e = __atomic_load_n(&fs->readers[i].epoch, __ATOMIC_ACQUIRE)) != 0 && e < epoch)
+            sched_yield();
+    }
+}
+
+/**
+ * Retire de la mémoire déjà rendue invisible aux nouvelles lectures. Elle est libérée
+ * par release quand les lectures commencées avant le retrait sont terminées.
+ * Doit être appelé avec dircache_lock.
+ */
+static void epoch_retire(struct sgf_mount *fs, void *ptr, void (*release)(void *)) {
+    struct fs_retired *r = malloc(sizeof(struct fs_retired));
+    if (r == NULL) {
+        // Sans mémoire pour différer la libération, attendre les lectures en cours
+        epoch_synchronize(fs);
+        release(ptr);
+        return;
+    }
+    r->ptr = ptr;
+    r->release = release;
+    r->epoch = __atomic_add_fetch(&fs->epoch, 1, __ATOMIC_SEQ_CST);
+    r->next = fs->retired;
+    fs->retired = r;
+    if (++fs->nretired >= FS_RETIRE_BATCH)
+        epoch_reclaim(fs);
+}
+
+// Alloue l'état d'un montage et initialise ses verrous, les groupes de l'allocateur à part
+static struct sgf_mount *mount_new(struct sgf_disk *disk) {
+    struct sgf_mount *fs = calloc(1, sizeof(struct sgf_mount));
+    if (fs == NULL) {
+        return NULL;
+    }
+    fs->disk = disk;
+    for (int i = 0; i < FS_INODE_LOCKS; i++)
+        pthread_rwlock_init(&fs->inode_locks[i], NULL);
+    for (int i = 0; i < FS_TABLE_LOCKS; i++)
+        pthread_mutex_init(&fs->table_locks[i], NULL);
+    for (int i = 0; i < FS_CACHE_BUCKETS; i++)
+        pthread_mutex_init(&fs->batch.buckets[i].lock, NULL);
+    pthread_mutex_init(&fs->batch.flush_lock, NULL);
+    pthread_mutex_init(&fs->journal.lock, NULL);
+    pthread_cond_init(&fs->journal.cond, NULL);
+    pthread_cond_init(&fs->journal.wake, NULL);
+    pthread_mutex_init(&fs->rename_lock, NULL);
+    pthread_mutex_init(&fs->lazy_lock, NULL);
+    pthread_mutex_init(&fs->tail_lock, NULL);
+    pthread_mutex_init(&fs->dircache_lock, NULL);
+    fs->epoch = 1;
+    pthread_mutex_init(&fs->session_lock, NULL);
+    return fs;
+}
+
+// Détruit les verrous d'un montage et libère son état
+static void mount_free(struct sgf_mount *fs) {
+    for (int i = 0; i < FS_INODE_LOCKS; i++)
+        pthread_rwlock_destroy(&fs->inode_locks[i]);
+    for (int i = 0; i < FS_TABLE_LOCKS; i++)
+        pthread_mutex_destroy(&fs->table_locks[i]);
+    for (int i = 0; i < FS_CACHE_BUCKETS; i++)
+        pthread_mutex_destroy(&fs->batch.buckets[i].lock);
+    for (int i = 0; fs->group_locks != NULL && i < fs->ngroups; i++)
+        pthread_mutex_destroy(&fs->group_locks[i]);
+    pthread_mutex_destroy(&fs->batch.flush_lock);
+    pthread_mutex_destroy(&fs->journal.lock);
+    pthread_cond_destroy(&fs->journal.cond);
+    pthread_cond_destroy(&fs->journal.wake);
+    free(fs->journal.freed.blocs);
+    pthread_mutex_destroy(&fs->rename_lock);
+    pthread_mutex_destroy(&fs->lazy_lock);
+    pthread_mutex_destroy(&fs->tail_lock);
+    pthread_mutex_destroy(&fs->dircache_lock);
+    pthread_mutex_destroy(&fs->session_lock);
+    free(fs->group_locks);
+    free(fs->group_hint);
+    free(fs);
+}
+
+/**
+ * Format du disque
+ * Fonction de formattage par le file system du disque.
+ * Seuls le superbloc et le répertoire racine sont écrits, le reste est initialisé à la demande.
+ * 
+ * retourne un booléen à true si le disque est formaté
+ */
+int fs_format(struct sgf_disk *disk) {
+    if (disk->mounted) {
+        printf("Disque monté : démontez-le avant de le formater\n");
+        return 0;
+    }
+    // Montage réduit au superbloc, le temps d'écrire la racine
+    struct sgf_mount *fs = mount_new(disk);
+    if (fs == NULL) {
+        return 0;
+    }
+    union fs_block block;
+
+    // Définition du SuperBloc.
+    memset(block.data, 0, BLOCK_SIZE);
+    block.super.magic = FS_MAGIC;
+    block.super.nblocks = disque_size(fs->disk);
+    block.super.ninodeblocks = disque_size(fs->disk) / 10 + 1;
+    block.super.ninodes = 128 * block.super.ninodeblocks;
+
+    // Zone des bitmaps après la table des inodes, écrite au démontage
+    block.super.mapstart = block.super.ninodeblocks + 1;
+    block.super.mapblocks = (map_words(&block.super) * sizeof(uint64_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // Journal des métadonnées entre les bitmaps et les données
+    int jblocks = block.super.nblocks / FS_JOURNAL_RATIO;
+    if (jblocks > FS_JOURNAL_MAX)
+        jblocks = FS_JOURNAL_MAX;
+    if (jblocks < FS_JOURNAL_MIN)
+        jblocks = 0;
+    block.super.journalstart = block.super.mapstart + block.super.mapblocks;
+    block.super.journalblocks = jblocks;
+    block.super.datastart = block.super.journalstart + jblocks;
+    block.super.state = 0;
+
+    if (block.super.datastart >= disque_size(fs->disk)) {
+        printf("Disque de taille insuffisante ou erreur de formattage de l'image monté\n");
+        mount_free(fs);
+        return 0;
+    }
+
+    // Les groupes sont agrandis tant que le superbloc ne peut pas tous les suivre
+    int gb = LAZY_GROUP_BLOCKS;
+    while ((block.super.ninodeblocks + gb - 1) / gb > LAZY_MAX_GROUPS)
+        gb *= 2;
+    block.super.groupblocks = gb;
+    block.super.ninodegroups = (block.super.ninodeblocks + gb - 1) / gb;
+
+    // La table des inodes n'est pas écrite : elle se lit comme des zéros
+    // jusqu'à la première écriture de chaque groupe
+    for (int group = 0; group < block.super.ninodegroups; group++)
+        block.super.uninit[group / 8] |= 1 << (group % 8);
+
+    // Ecrire le SuperBlock dans le disque
+    bloc_write(fs, 0, block.data);
+    fs->sb = block;
+
+    // Rendre à l'hôte la place occupée par un ancien contenu. Si l'hôte ne sait pas percer
+    // l'image, le journal est effacé : ses anciennes transactions ne doivent jamais être rejouées
+    if (!disque_liberer(fs->disk, 1, block.super.nblocks - 1) && jblocks > 0) {
+        union fs_block zero;
+        memset(zero.data, 0, BLOCK_SIZE);
+        for (int k = 0; k < jblocks; k++)
+            bloc_write(fs, block.super.journalstart + k, zero.data);
+    }
+
+    // Définir la racine du système de fichiers : un inode répertoire et son premier bloc d'entrées
+    union fs_block inodes;
+    memset(inodes.data, 0, BLOCK_SIZE);
+    struct fs_inode *root = &inodes.inode[INODE_OFFSET(FS_ROOT_INUM)];
+    root->isvalid = INODE_VALID | INODE_DIR;
+    root->size = BLOCK_SIZE;
+    root->direct[0] = block.super.datastart;
+    meta_write(fs, INODE_BLOC(FS_ROOT_INUM), inodes.data);
+
+    union fs_block dirblock;
+    dirblk_init_dots(&dirblock, FS_ROOT_INUM, FS_ROOT_INUM);
+    bloc_write(fs, root->direct[0], dirblock.data);
+
+    // Bitmaps du disque vide : le premier montage n'a pas à parcourir la table des inodes
+    uint64_t *bits = calloc(block.super.mapblocks, BLOCK_SIZE);
+    if (bits != NULL) {
+        int wb = (block.super.nblocks + 63) / 64;
+        bits[INODE_BLOC(FS_ROOT_INUM) / 64] |= (uint64_t) 1 << (INODE_BLOC(FS_ROOT_INUM) % 64);
+        bits[root->direct[0] / 64] |= (uint64_t) 1 << (root->direct[0] % 64);
+        bits[2 * wb] |= 1 | (uint64_t) 1 << FS_ROOT_INUM;
+        for (int k = 0; k < block.super.mapblocks; k++)
+            bloc_write(fs, block.super.mapstart + k, (char *) bits + k * BLOCK_SIZE);
+        free(bits);
+    }
+
+    if (jblocks > 0) {
+        memset(dirblock.data, 0, BLOCK_SIZE);
+        dirblock.jsuper.magic = JOURNAL_MAGIC;
+        dirblock.jsuper.seq = 1;
+        dirblock.jsuper.tail = 1;
+        bloc_write(fs, block.super.journalstart, dirblock.data);
+    }
+
+    if (bits != NULL) {
+        fs->sb.super.state = FS_CLEAN;
+        bloc_write(fs, 0, fs->sb.data);
+    }
+    mount_free(fs);
+    return 1;
+}
+
+/**
+ * Vérifie qu'un superbloc décrit un système de fichiers formaté sur ce disque :
+ * les zones doivent se suivre comme fs_format les dispose, à l'intérieur du disque.
+ *
+ * @return vrai si le superbloc est utilisable
+ */
+static int super_valid(struct fs_superblock *super, int nblocks) {
+    if (super->magic != FS_MAGIC || super->nblocks != nblocks) {
+        return 0;
+    }
+    if (super->ninodeblocks < 1 || super->ninodeblocks >= nblocks
+        || super->ninodes != INODES_PER_BLOCK * super->ninodeblocks) {
+        return 0;
+    }
+    if (super->groupblocks < 0 || super->ninodegroups < 0 || super->ninodegroups > LAZY_MAX_GROUPS
+        || (super->groupblocks > 0
+            && super->ninodegroups != (super->ninodeblocks + super->groupblocks - 1) / super->groupblocks)) {
+        return 0;
+    }
+    int mapblocks = (map_words(super) * sizeof(uint64_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (super->mapstart != super->ninodeblocks + 1 || super->mapblocks != mapblocks) {
+        return 0;
+    }
+    int end = super->mapstart + super->mapblocks;
+    if (super->journalblocks < 0) {
+        return 0;
+    }
+    if (super->journalblocks > 0) {
+        if (super->journalstart != end) {
+            return 0;
+        }
+        end += super->journalblocks;
+    }
+    return super->datastart >= end && super->datastart < nblocks;
+}
+
+/**
+ * Monter le file system. Après un démontage propre ou le rejeu du journal, les bitmaps
+ * sont relus depuis le disque, sinon ils sont reconstruits en parcourant la table des inodes.
+ *
+ */
+struct sgf_mount *fs_mount(struct sgf_disk *disk) {
+    if (disk->mounted) {
+        printf("Disque déjà monté\n");
+        return NULL;
+    }
+    struct sgf_mount *fs = mount_new(disk);
+    if (fs == NULL) {
+        return NULL;
+    }
+
+    union fs_block block;
+    // Lire et vérifier le SuperBlock
+    bloc_read(fs, 0, block.data);
+    if (!super_valid(&block.super, disque_size(disk))) {
+        printf("Disque non formaté ou superbloc invalide\n");
+        mount_free(fs);
+        return NULL;
+    }
+    fs->sb = block;
+
+    // Alloue la mémoire pour le bitmap
+    fs->bitmap = calloc(block.super.nblocks, sizeof(int));
+    fs->bitmap_size = block.super.nblocks;
+
+    fs->ngroups = (block.super.nblocks + FS_ALLOC_GROUP - 1) / FS_ALLOC_GROUP;
+    fs->group_locks = malloc(fs->ngroups * sizeof(pthread_mutex_t));
+    fs->group_hint = malloc(fs->ngroups * sizeof(int));
+    for (int g = 0; g < fs->ngroups; g++) {
+        pthread_mutex_init(&fs->group_locks[g], NULL);
+        fs->group_hint[g] = g * FS_ALLOC_GROUP;
+        if (fs->group_hint[g] < block.super.datastart)
+            fs->group_hint[g] = block.super.datastart;
+    }
+
+    // État des blocs de fragments
+    fs->tails = malloc(block.super.nblocks * sizeof(struct tail_etat));
+    for (int i = 0; i < block.super.nblocks; i++) {
+        fs->tails[i].libre = -1;
+        fs->tails[i].slots = 0;
+    }
+    fs->tail_courant = 0;
+    fs->tail_recycle = 1;
+
+    fs->inode_bitmap = calloc(block.super.ninodes / 64, sizeof(uint64_t));
+    fs->inode_free = malloc(block.super.ninodeblocks * sizeof(int));
+
+    // analyse le système de fichiers pour définir correctement le bitmap pour le système de fichiers donné
+    union fs_block inode_block;
+    struct fs_inode inode;
+    // Avec un journal, rejouer ses transactions suffit à remettre à jour les bitmaps sur disque
+    int journaled = block.super.journalblocks > 0 && journal_open(fs, block.super.state != FS_CLEAN);
+    int scan = (block.super.state != FS_CLEAN && !journaled) || !map_load(fs);
+    for (int i = 1; scan && i <= block.super.ninodeblocks; i++) {
+
+        // Un groupe non initialisé ne contient aucun inode valide
+        int group = lazy_group(fs, i);
+        if (LAZY_UNINIT(fs, group)) {
+            i = (group + 1) * block.super.groupblocks;
+            continue;
+        }
+
+        meta_read(fs, i, inode_block.data);
+
+        for (int i_node = 0; i_node < INODES_PER_BLOCK; i_node++) {
+
+            inode = inode_block.inode[i_node];
+
+            if (inode.isvalid) {
+                fs->bitmap[i] = 1;
+                int inum = (i - 1) * INODES_PER_BLOCK + i_node;
+                fs->inode_bitmap[inum / 64] |= (uint64_t) 1 << (inum % 64);
+
+                struct fs_map map;
+                map_init(&map, &inode);
+                if (inode.indirect != 0) {
+                    fs->bitmap[inode.indirect] = 1;
+                }
+                if (inode.dindirect != 0) {
+                    fs->bitmap[inode.dindirect] = 1;
+                    bloc_read(fs, inode.dindirect, map.dind.data);
+                    map.dind_loaded = 1;
+                    for (int l1 = 0; l1 < POINTERS_PER_BLOCK; l1++) {
+                        if (map.dind.pointers[l1] != 0)
+                            fs->bitmap[map.dind.pointers[l1]] = 1;
+                    }
+                }
+                for (int d_blocks = 0; d_blocks * BLOCK_SIZE < inode.size; d_blocks++) {
+                    int ptr = map_get(fs, &map, d_blocks);
+                    if (ptr > 0) {
+                        fs->bitmap[ptr] = 1;
+                    } else if (ptr < 0) {
+                        // Bloc de fragments, son remplissage est calculé plus bas
+                        fs->bitmap[TAIL_BLOC(ptr)] = 1;
+                        fs->tails[TAIL_BLOC(ptr)].libre = 0;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < block.super.nblocks; i++) {
+        if (fs->tails[i].libre == 0) {
+            bloc_read(fs, i, inode_block.data);
+            fs->tails[i].libre = TAIL_DATA;
+            fs->tails[i].slots = TAIL_SLOTS;
+            for (int slot = 0; slot < TAIL_SLOTS; slot++) {
+                if (inode_block.tail.slots[slot].inum != 0) {
+                    fs->tails[i].libre -= inode_block.tail.slots[slot].length;
+                    fs->tails[i].slots--;
+                }
+            }
+        }
+    }
+
+    // L'inode 0 n'est jamais alloué
+    fs->inode_bitmap[0] |= 1;
+    for (int b = 0; b < block.super.ninodeblocks; b++) {
+        fs->inode_free[b] = INODES_PER_BLOCK - __builtin_popcountll(fs->inode_bitmap[2 * b])
+                        - __builtin_popcountll(fs->inode_bitmap[2 * b + 1]);
+    }
+    fs->inode_hint = 0;
+
+    // Sans son journal, un arrêt brutal laisserait croire au prochain montage que les bitmaps
+    // sur disque sont à jour : le montage échoue avant que le superbloc ne soit modifié
+    if (block.super.journalblocks > 0 && !journal_start(fs, scan)) {
+        printf("Journal indisponible\n");
+        journal_stop(fs);
+        free(fs->bitmap);
+        free(fs->inode_bitmap);
+        free(fs->inode_free);
+        free(fs->tails);
+        mount_free(fs);
+        return NULL;
+    }
+
+    // Tant que le disque est monté, les bitmaps sur disque ne sont plus à jour
+    fs->sb.super.state = 0;
+    bloc_write(fs, 0, fs->sb.data);
+
+    fs->dcache = calloc(DCACHE_SIZE, sizeof(struct fs_dentry));
+    fs->dircaches = calloc(DIRCACHE_DIRS, sizeof(struct fs_dircache));
+    fs->dirblooms = calloc(DIRBLOOM_DIRS, sizeof(struct fs_dirbloom));
+
+    disk->mounted = 1;
+    return fs;
+}
+
+/**
+ * Démonte le file system, le thread d'initialisation différée est arrêté.
+ * Les bitmaps sont écrits sur disque et le superbloc marqué propre.
+ *
+ * @return vrai en cas de succès, faux si aucun disque n'est monté
+ */
+int fs_umount(struct sgf_mount *fs) {
+    if (fs == NULL) {
+        return 0;
+    }
+    if (fs->sessions != NULL) {
+        printf("Des sessions sont encore ouvertes\n");
+        return 0;
+    }
+
+    if (fs->lazy_running) {
+        fs->lazy_stop = 1;
+        pthread_join(fs->lazy_thread, NULL);
+        fs->lazy_running = 0;
+    }
+    aio_pool_stop(fs);
+    journal_stop(fs);
+
+    if (map_save(fs)) {
+        // Les bitmaps sont durables avant que le superbloc ne les déclare à jour
+        if (fs->sb.super.journalblocks > 0)
+            disque_sync(fs->disk);
+        fs->sb.super.state = FS_CLEAN;
+        bloc_write(fs, 0, fs->sb.data);
+    }
+
+    free(fs->bitmap);
+    free(fs->inode_bitmap);
+    free(fs->inode_free);
+    free(fs->tails);
+    free(fs->dcache);
+    if (fs->dircaches) {
+        for (int i = 0; i < DIRCACHE_DIRS; i++)
+            dircache_free(fs, &fs->dircaches[i]);
+        free(fs->dircaches);
+    }
+    if (fs->dirblooms) {
+        for (int i = 0; i < DIRBLOOM_DIRS; i++)
+            free(fs->dirblooms[i].bits);
+        free(fs->dirblooms);
+    }
+    // Plus aucune lecture n'est en cours, toute la mémoire retirée est libérée
+    epoch_reclaim(fs);
+    fs->disk->mounted = 0;
+    mount_free(fs);
+    return 1;
+}
+
+/**
+ * Initialise en arrière-plan les groupes de la table des inodes
+ * que le formatage a laissés de côté
+ *
+ * @return vrai si le thread est lancé
+ */
+int fs_lazy_init(struct sgf_mount *fs) {
+    if (fs == NULL) {
+        printf("Veuillez monter le disque\n");
+        return 0;
+    }
+    if (fs->lazy_running) {
+        return 1;
+    }
+
+    fs->lazy_stop = 0;
+    if (thread_start(&fs->lazy_thread, lazy_worker, fs) != 0) {
+        return 0;
+    }
+    fs->lazy_running = 1;
+    return 1;
+}
+
+/**
+ * Rend durables les opérations terminées avant l'appel. Avec un journal, la transaction
+ * ouverte est validée ; sans journal, le cache est écrit sur place. Le disque n'est vidé
+ * que si la validation ne l'a pas déjà fait.
+ *
+ * @return vrai en cas de succès
+ */
+static int mount_sync(struct sgf_mount *fs) {
+    if (!fs->journal.running) {
+        batch_flush(fs);
+        return disque_sync(fs->disk);
+    }
+    unsigned long written = disque_written(fs->disk);
+    int ok = journal_sync(fs);
+    return disque_sync_upto(fs->disk, written) && ok;
+}
+
+/**
+ * Rend durables toutes les opérations terminées. Les appels concurrents,
+ * comme ceux de fs_fsync, partagent un même vidage du disque.
+ *
+ * @return vrai en cas de succès
+ */
+int fs_sync(struct sgf_mount *fs) {
+    if (fs == NULL) {
+        printf("Veuillez monter le disque\n");
+        return 0;
+    }
+    return mount_sync(fs);
+}
+
+/**
+ * Alloue un Inode du type donné dans la table des Inodes, trouvé avec
+ * le bitmap des inodes et le nombre d'inodes libres de chaque bloc
+ *
+ * @param flags Drapeaux de l'inode (INODE_VALID, INODE_DIR)
+ * @return Numéro de l'Inode alloué, 0 si la table est pleine
+ */
+static int inode_alloc(struct sgf_mount *fs, int flags) {
+    if (fs == NULL) {
+        return 0;
+    }
+
+    // Premier bloc de la table ayant un inode libre, à partir de l'indice. Le compte lu sans
+    // verrou n'est qu'une piste, il est vérifié sous le verrou du bloc.
+    int ninodeblocks = fs->sb.super.ninodeblocks;
+    int hint = __atomic_load_n(&fs->inode_hint, __ATOMIC_RELAXED);
+    int b = -1;
+    pthread_mutex_t *lock = NULL;
+    for (int n = 0; n < ninodeblocks; n++) {
+        int candidate = (hint + n) % ninodeblocks;
+        if (__atomic_load_n(&fs->inode_free[candidate], __ATOMIC_RELAXED) > 0) {
+            lock = &fs->table_locks[candidate % FS_TABLE_LOCKS];
+            pthread_mutex_lock(lock);
+            if (fs->inode_free[candidate] > 0) {
+                b = candidate;
+                break;
+            }
+            pthread_mutex_unlock(lock);
+        }
+    }
+    if (b == -1) {
+        return 0;
+    }
+
+    int w = 2 * b;
+    if (~fs->inode_bitmap[w] == 0)
+        w++;
+    int inumber = w * 64 + __builtin_ctzll(~fs->inode_bitmap[w]);
+    fs->inode_bitmap[w] |= (uint64_t) 1 << (inumber % 64);
+    __atomic_store_n(&fs->inode_free[b], fs->inode_free[b] - 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&fs->inode_hint, b, __ATOMIC_RELAXED);
+
+    union fs_block block;
+    meta_read(fs, INODE_BLOC(inumber), block.data);
+    struct fs_inode *inode = &block.inode[INODE_OFFSET(inumber)];
+    memset(inode, 0, sizeof(*inode));
+    inode->isvalid = flags;
+    meta_write(fs, INODE_BLOC(inumber), block.data);
+    pthread_mutex_unlock(lock);
+    bitmap_reserve(fs, INODE_BLOC(inumber));
+    return inumber;
+}
+
+/**
+ * Ouvre une session sur un système de fichiers monté, son répertoire courant est la racine
+ *
+ * @return La session, NULL en cas d'erreur
+ */
+struct sgf_session *fs_session_open(struct sgf_mount *fs) {
+    if (fs == NULL) {
+        return NULL;
+    }
+    struct sgf_session *s = calloc(1, sizeof(struct sgf_session));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->fs = fs;
+    s->cwd.isvalid = 1;
+    s->cwd.inum = FS_ROOT_INUM;
+    strcpy(s->cwd.name, "/");
+
+    pthread_mutex_lock(&fs->session_lock);
+    s->next = fs->sessions;
+    fs->sessions = s;
+    pthread_mutex_unlock(&fs->session_lock);
+    return s;
+}
+
+/**
+ * Ferme une session
+ */
+void fs_session_close(struct sgf_session *s) {
+    if (s == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&s->fs->session_lock);
+    struct sgf_session **p = &s->fs->sessions;
+    while (*p != s)
+        p = &(*p)->next;
+    *p = s->next;
+    pthread_mutex_unlock(&s->fs->session_lock);
+    free(s);
+}
+
+/**
+ * Répertoire courant d'une session
+ */
+struct fs_directory fs_getcwd(struct sgf_session *s) {
+    struct fs_directory none = {0};
+    return s ? s->cwd : none;
+}
+
+/**
+ * Alloue un Inode de fichier dans la table des Inodes du Système de Fichier
+ *
+ * @return Numéro de l'Inode alloué si valide, 0 si la table est pleine
+ */
+int fs_create(struct sgf_mount *fs) {
+    if (fs == NULL) {
+        return 0;
+    }
+    batch_begin(fs);
+    int inumber = inode_alloc(fs, INODE_VALID);
+    batch_commit(fs);
+    return inumber;
+}
+
+/**
+ * Lit un inode dans la table des inodes
+ *
+ * @param inumber Numéro de l'inode
+ * @param inode Reçoit l'inode
+ * @return vrai si l'inode est valide
+ */
+static int inode_load(struct sgf_mount *fs, int inumber, struct fs_inode *inode) {
+    if (inumber <= 0 || inumber >= fs->sb.super.ninodes) {
+        return 0;
+    }
+    union fs_block block;
+    meta_read(fs, INODE_BLOC(inumber), block.data);
+    *inode = block.inode[INODE_OFFSET(inumber)];
+    return inode->isvalid != 0;
+}
+
+// Verrou lecteurs-rédacteurs d'un inode
+#define INODE_LOCK(fs, inumber) (&(fs)->inode_locks[(unsigned int) (inumber) % FS_INODE_LOCKS])
+
+// Verrou du bloc de la table contenant un inode
+#define TABLE_LOCK(fs, inumber) (&(fs)->table_locks[(INODE_BLOC(inumber) - 1) % FS_TABLE_LOCKS])
+
+/**
+ * Prend en écriture les verrous de plusieurs inodes, par indice croissant et chacun une seule fois
+ *
+ * @param inums Inodes à verrouiller, 0 est ignoré
+ * @param n Nombre d'inodes
+ * @param held Reçoit les indices des verrous pris, au moins n places
+ * @return Nombre de verrous pris
+ */
+static int inode_lock_many(struct sgf_mount *fs, const int inums[], int n, int held[]) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (inums[i] == 0)
+            continue;
+        int lock = (unsigned int) inums[i] % FS_INODE_LOCKS;
+        int j = 0;
+        while (j < count && held[j] != lock)
+            j++;
+        if (j == count)
+            held[count++] = lock;
+    }
+    qsort(held, count, sizeof(int), compare_int);
+    for (int i = 0; i < count; i++)
+        pthread_rwlock_wrlock(&fs->inode_locks[held[i]]);
+    return count;
+}
+
+static void inode_unlock_many(struct sgf_mount *fs, const int held[], int count) {
+    for (int i = count - 1; i >= 0; i--)
+        pthread_rwlock_unlock(&fs->inode_locks[held[i]]);
+}
+
+// Vérifie que les verrous pris couvrent tous les inodes donnés
+static int inode_locks_cover(const int held[], int count, const int inums[], int n) {
+    for (int i = 0; i < n; i++) {
+        int j = 0;
+        while (j < count && held[j] != (int) ((unsigned int) inums[i] % FS_INODE_LOCKS))
+            j++;
+        if (inums[i] != 0 && j == count)
+            return 0;
+    }
+    return 1;
+}
+
+// Écrit un inode dans la table des inodes, les autres inodes du bloc sont relus sous son verrou
+static void inode_store(struct sgf_mount *fs, int inumber, struct fs_inode *inode) {
+    union fs_block block;
+    pthread_mutex_lock(TABLE_LOCK(fs, inumber));
+    meta_read(fs, INODE_BLOC(inumber), block.data);
+    block.inode[INODE_OFFSET(inumber)] = *inode;
+    meta_write(fs, INODE_BLOC(inumber), block.data);
+    pthread_mutex_unlock(TABLE_LOCK(fs, inumber));
+}
+
+/**
+ * Libère un inode et ajoute ses blocs à une liste de blocs à libérer
+ *
+ * @param inumber Inode à libérer
+ * @param fl Reçoit les blocs du fichier
+ * @return vrai si l'inode était valide
+ */
+static int inode_release(struct sgf_mount *fs, int inumber, struct fs_freelist *fl) {
+    int inode_block_index = INODE_BLOC(inumber);
+
+    union fs_block block;
+    if (inumber <= 0 || inode_block_index > fs->sb.super.ninodeblocks) {
+        printf("Erreur de limite d'inode\n");
+        return 0;
+    }
+    meta_read(fs, inode_block_index, block.data);
+
+    struct fs_inode inode = block.inode[INODE_OFFSET(inumber)];
+    if (!inode.isvalid) {
+        return 0;
+    }
+    inode_truncate(fs, inumber, &inode, 0, fl);
+
+    // Le bloc est relu sous son verrou : d'autres inodes du bloc ont pu changer
+    pthread_mutex_lock(TABLE_LOCK(fs, inumber));
+    meta_read(fs, inode_block_index, block.data);
+    block.inode[INODE_OFFSET(inumber)] = (struct fs_inode) {0};
+    meta_write(fs, inode_block_index, block.data);
+
+    fs->inode_bitmap[inumber / 64] &= ~((uint64_t) 1 << (inumber % 64));
+    __atomic_store_n(&fs->inode_free[inode_block_index - 1], fs->inode_free[inode_block_index - 1] + 1, __ATOMIC_RELAXED);
+    if (inode_block_index - 1 < __atomic_load_n(&fs->inode_hint, __ATOMIC_RELAXED))
+        __atomic_store_n(&fs->inode_hint, inode_block_index - 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(TABLE_LOCK(fs, inumber));
+    return 1;
+}
+
+/**
+ * Suppression de l'Inode et des données associées du Système de Fichier
+ * @param inumber Inode à supprimer.
+ * @return true si Inode supprimé
+ */
+static int file_delete(struct sgf_mount *fs, int inumber) {
+    if (fs == NULL) {
+        return 0;
+    }
+    // Libérer tous les blocs du fichier en un seul lot
+    struct fs_freelist fl = {0};
+    if (!inode_release(fs, inumber, &fl)) {
+        return 0;
+    }
+    freelist_commit(fs, &fl);
+    return 1;
+}
+
+// Supprime un fichier sous le verrou de son inode
+int fs_delete(struct sgf_mount *fs, int inumber) {
+    if (fs == NULL) {
+        return 0;
+    }
+    batch_begin(fs);
+    pthread_rwlock_wrlock(INODE_LOCK(fs, inumber));
+    int ret = file_delete(fs, inumber);
+    pthread_rwlock_unlock(INODE_LOCK(fs, inumber));
+    batch_commit(fs);
+    return ret;
+}
+
+/**
+ * Change la taille d'un fichier. Réduire libère les blocs au-delà en un seul lot,
+ * agrandir ajoute un trou sans allouer de bloc.
+ *
+ * @param inumber Inode du fichier
+ * @param newsize Nouvelle taille en octets
+ * @return vrai en cas de succès, faux en cas d'échec
+ */
+static int file_truncate(struct sgf_mount *fs, int inumber, int newsize) {
+    if (fs == NULL) {
+        return 0;
+    }
+    union fs_block block;
+    if (inumber <= 0 || inumber >= fs->sb.super.ninodes || newsize < 0) {
+        printf("Erreur inode\n");
+        return 0;
+    }
+
+    int inode_block_index = INODE_BLOC(inumber);
+    meta_read(fs, inode_block_index, block.data);
+
+    struct fs_inode inode = block.inode[INODE_OFFSET(inumber)];
+    if (!inode.isvalid || (inode.isvalid & INODE_DIR)) {
+        printf("Erreur inode\n");
+        return 0;
+    }
+    if (newsize == inode.size) {
+        return 1;
+    }
+
+    struct fs_freelist fl = {0};
+    if (newsize > inode.size) {
+        // Agrandir laisse un trou. Une fin rangée en fragment redevient un bloc entier
+        // si le fichier dépasse son bloc.
+        int tail_index = (inode.size - 1) / BLOCK_SIZE;
+        struct fs_map map;
+        map_init(&map, &inode);
+        if (inode.size > 0 && newsize > (tail_index + 1) * BLOCK_SIZE && map_get(fs, &map, tail_index) < 0) {
+            union fs_block temp_block;
+            int bloc = tail_unpack(fs, &map, tail_index, temp_block.data);
+            if (bloc == -1) {
+                printf("Taille insuffisante\n");
+                return 0;
+            }
+            data_write(fs, bloc, temp_block.data);
+            map_flush(fs, &map);
+        }
+        inode.size = newsize;
+    } else {
+        inode_truncate(fs, inumber, &inode, newsize, &fl);
+    }
+
+    inode_store(fs, inumber, &inode);
+
+    freelist_commit(fs, &fl);
+    return 1;
+}
+
+// Change la taille d'un fichier sous le verrou de son inode
+int fs_truncate(struct sgf_mount *fs, int inumber, int newsize) {
+    if (fs == NULL) {
+        return 0;
+    }
+    batch_begin(fs);
+    pthread_rwlock_wrlock(INODE_LOCK(fs, inumber));
+    int ret = file_truncate(fs, inumber, newsize);
+    pthread_rwlock_unlock(INODE_LOCK(fs, inumber));
+    batch_commit(fs);
+    return ret;
+}
+
+/**
+ * Lit à partir de l'inode spécifié dans le tampon de données, 
+ * la longeur du tampon en commençant par l'offset spécifié.
+ * Un pointeur à 0 est un trou, lu comme des zéros sans accès disque.
+ *
+ * @param inumber Inode pour lire les données.
+ * @param data Data buffer
+ * @param length Nombre d'octets à lire.
+ * @param offset Décalage de l'octet à partir duquel la lecture doit commencer.
+ * @return Nombre d'octets lus (-1 en cas d'erreur).
+ */
+static int file_read(struct sgf_mount *fs, int inumber, char *data, int length, int offset) {
+    if (fs == NULL) {
+        return -1;
+    }
+    union fs_block block;
+    if (inumber <= 0 || inumber >= fs->sb.super.ninodes || offset < 0 || length < 0) {
+        printf("Erreur inode\n");
+        return -1;
+    }
+    memset(data, 0, length);
+
+    int total_data_read = 0;
+    meta_read(fs, INODE_BLOC(inumber), block.data);
+
+    struct fs_inode inode = block.inode[INODE_OFFSET(inumber)];
+    if (!inode.isvalid || (inode.isvalid & INODE_DIR) || inode.size == 0) {
+        printf("Erreur inode\n");
+    } else {
+        if (offset >= inode.size)
+            return -1;
+
+        struct fs_map map;
+        map_init(&map, &inode);
+        union fs_block temp_block;
+
+        int max_limit = length;
+        if (inode.size < length + offset)
+            max_limit = inode.size - offset;
+
+        // Lit continuellement les blocs et copier les données dans la mémoire tampon.
+        while (total_data_read < max_limit) {
+            int index = (offset + total_data_read) / BLOCK_SIZE;
+            int start = (offset + total_data_read) % BLOCK_SIZE;
+
+            int chunk = BLOCK_SIZE - start;
+            if (chunk + total_data_read > max_limit)
+                chunk = max_limit - total_data_read;
+
+            int ptr = map_get(fs, &map, index);
+            if (ptr == 0) {
+                // Trou : le tampon est déjà à zéro, aucune lecture
+            } else if (ptr < 0) {
+                // Fin du fichier rangée dans un bloc de fragments
+                tail_read(fs, ptr, data + total_data_read, start, chunk);
+            } else {
+                bloc_read(fs, ptr, temp_block.data);
+                memcpy(data + total_data_read, temp_block.data + start, chunk);
+            }
+            total_data_read += chunk;
+        }
+        return total_data_read;
+    }
+
+    return -1;
+}
+
+// Lecture partagée avec les autres lecteurs de l'inode
+int fs_read(struct sgf_mount *fs, int inumber, char *data, int length, int offset) {
+    if (fs == NULL) {
+        return -1;
+    }
+    pthread_rwlock_rdlock(INODE_LOCK(fs, inumber));
+    int ret = file_read(fs, inumber, data, length, offset);
+    pthread_rwlock_unlock(INODE_LOCK(fs, inumber));
+    return ret;
+}
+
+/**
+ * Ecriture via l'inode donné dans le buffer de données,
+ * la longeur du buffer en commençant par l'offset spécifié.
+ * Une fin de fichier d'au plus TAIL_MAX octets est rangée dans un bloc de fragments.
+ * Écrire après la fin du fichier laisse un trou, seuls les blocs écrits sont alloués.
+ *
+ * @param inumber Inode pour lire les données.
+ * @param data Data buffer
+ * @param length Nombre d'octets à lire.
+ * @param offset Décalage de l'octet à partir duquel la lecture doit commencer.
+ * @return Nombre d'octets lus (-1 en cas d'erreur).
+ */
+static int file_write(struct sgf_mount *fs, int inumber, const char *data, int length, int offset) {
+    if (fs == NULL) {
+        return -1;
+    }
+    union fs_block block;
+    if (inumber <= 0 || inumber >= fs->sb.super.ninodes || offset < 0 || length <= 0) {
+        return -1;
+    }
+
+    int total_wrote = 0;
+    int inode_block_index = INODE_BLOC(inumber);
+
+    // Chargement des informations sur les inodes.
+    meta_read(fs, inode_block_index, block.data);
+
+    struct fs_inode inode = block.inode[INODE_OFFSET(inumber)];
+    if (!inode.isvalid || (inode.isvalid & INODE_DIR) || length > INT32_MAX - offset) {
+        printf("Erreur inode\n");
+        return -1;
+    }
+
+    struct fs_map map;
+    map_init(&map, &inode);
+    union fs_block temp_block, tail_block;
+
+    // La fin du fichier est touchée par l'écriture : la sortir de son bloc de fragments
+    int unpacked = -1;
+    if (inode.size > 0) {
+        int tail_index = (inode.size - 1) / BLOCK_SIZE;
+        if (offset + length > tail_index * BLOCK_SIZE && map_get(fs, &map, tail_index) < 0) {
+            if (tail_unpack(fs, &map, tail_index, tail_block.data) == -1) {
+                printf("Taille insuffisante\n");
+                return -1;
+            }
+            unpacked = tail_index;
+        }
+    }
+
+    int new_size = inode.size;
+    if (offset + length > new_size)
+        new_size = offset + length;
+    int last_index = (new_size - 1) / BLOCK_SIZE;
+    int tail_length = new_size % BLOCK_SIZE;
+
+    // Copie en continu des données du tampon vers les blocs.
+    int pending = 0;
+    while (total_wrote < length) {
+        int index = (offset + total_wrote) / BLOCK_SIZE;
+        int start = (offset + total_wrote) % BLOCK_SIZE;
+
+        int chunk = BLOCK_SIZE - start;
+        if (chunk + total_wrote > length)
+            chunk = length - total_wrote;
+
+        int ptr = map_get(fs, &map, index);
+        if (index == unpacked) {
+            memcpy(temp_block.data, tail_block.data, BLOCK_SIZE);
+            unpacked = -1;
+        } else if (ptr == 0 && chunk == BLOCK_SIZE && bloc_nul(data + total_wrote, chunk)) {
+            // Un bloc entier de zéros sur un trou reste un trou
+            total_wrote += chunk;
+            continue;
+        } else if (ptr == 0) {
+            ptr = get_bloc(fs);
+            if (ptr == -1) {
+                printf("Taille insuffisante\n");
+                break;
+            }
+            if (!map_set(fs, &map, index, ptr)) {
+                bitmap_release(fs, ptr);
+                printf("Taille insuffisante\n");
+                break;
+            }
+            memset(temp_block.data, 0, BLOCK_SIZE);
+        } else if (chunk < BLOCK_SIZE) {
+            bloc_read(fs, ptr, temp_block.data);
+        }
+
+        memcpy(temp_block.data + start, data + total_wrote, chunk);
+        total_wrote += chunk;
+
+        // Le dernier bloc du fichier est gardé en mémoire pour être rangé en fragment
+        if (index == last_index && tail_length > 0 && tail_length <= TAIL_MAX) {
+            pending = ptr;
+        } else {
+            data_write(fs, ptr, temp_block.data);
+        }
+    }
+
+    // Bloc sorti des fragments mais non touché par l'écriture
+    if (unpacked != -1) {
+        data_write(fs, map_get(fs, &map, unpacked), tail_block.data);
+    }
+
+    if (offset + total_wrote > inode.size)
+        inode.size = offset + total_wrote;
+
+    if (pending) {
+        int ref = 0;
+        if (inode.size == new_size)
+            ref = tail_alloc(fs, inumber, temp_block.data, tail_length);
+        if (ref != 0) {
+            map_set(fs, &map, last_index, ref);
+            bloc_free(fs, pending);
+        } else {
+            data_write(fs, pending, temp_block.data);
+        }
+    }
+
+    map_flush(fs, &map);
+    inode_store(fs, inumber, &inode);
+
+    if (total_wrote == 0)
+        return -1;
+    return total_wrote;
+}
+
+// Écriture exclusive sur l'inode
+int fs_write(struct sgf_mount *fs, int inumber, const char *data, int length, int offset) {
+    if (fs == NULL) {
+        return -1;
+    }
+    batch_begin(fs);
+    pthread_rwlock_wrlock(INODE_LOCK(fs, inumber));
+    int ret = file_write(fs, inumber, data, length, offset);
+    pthread_rwlock_unlock(INODE_LOCK(fs, inumber));
+    batch_commit(fs);
+    return ret;
+}
+
+/**
+ * Cherche la prochaine zone de données ou le prochain trou à partir de l'offset.
+ * La fin du fichier compte comme un trou.
+ *
+ * @param inumber Inode du fichier
+ * @param offset Décalage de départ
+ * @param whence FS_SEEK_DATA ou FS_SEEK_HOLE
+ * @return Décalage trouvé, -1 si l'offset est au-delà de la fin ou s'il n'y a plus de données
+ */
+static int file_lseek(struct sgf_mount *fs, int inumber, int offset, int whence) {
+    if (fs == NULL) {
+        return -1;
+    }
+    union fs_block block;
+    if (inumber <= 0 || inumber >= fs->sb.super.ninodes || offset < 0) {
+        return -1;
+    }
+    meta_read(fs, INODE_BLOC(inumber), block.data);
+
+    struct fs_inode inode = block.inode[INODE_OFFSET(inumber)];
+    if (!inode.isvalid || offset >= inode.size) {
+        return -1;
+    }
+
+    struct fs_map map;
+    map_init(&map, &inode);
+    int nblocks = (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    for (int index = offset / BLOCK_SIZE; index < nblocks; index++) {
+        int ptr = map_get(fs, &map, index);
+        if ((whence == FS_SEEK_DATA && ptr != 0) || (whence == FS_SEEK_HOLE && ptr == 0)) {
+            int found = index * BLOCK_SIZE;
+            return found > offset ? found : offset;
+        }
+    }
+
+    if (whence == FS_SEEK_HOLE) {
+        return inode.size;
+    }
+    return -1;
+}
+
+// Recherche partagée avec les autres lecteurs de l'inode
+int fs_lseek(struct sgf_mount *fs, int inumber, int offset, int whence) {
+    if (fs == NULL) {
+        return -1;
+    }
+    pthread_rwlock_rdlock(INODE_LOCK(fs, inumber));
+    int ret = file_lseek(fs, inumber, offset, whence);
+    pthread_rwlock_unlock(INODE_LOCK(fs, inumber));
+    return ret;
+}
+
+/**
+ * Rend durables les données et les métadonnées d'un inode. Ses métadonnées partagent
+ * la transaction ouverte avec celles des autres inodes : elle est validée entière.
+ *
+ * @param inumber Inode du fichier ou du répertoire
+ * @return vrai en cas de succès
+ */
+int fs_fsync(struct sgf_mount *fs, int inumber) {
+    if (fs == NULL) {
+        return 0;
+    }
+    struct fs_inode inode;
+    pthread_rwlock_rdlock(INODE_LOCK(fs, inumber));
+    int valid = inode_load(fs, inumber, &inode);
+    pthread_rwlock_unlock(INODE_LOCK(fs, inumber));
+    if (!valid) {
+        printf("Erreur inode\n");
+        return 0;
+    }
+    return mount_sync(fs);
+}
+
+// Répertoire ouvert : son inode et l'accès à ses blocs d'entrées et d'index
+struct fs_dirh {
+    int inum;
+    struct fs_inode inode;
+    struct fs_map map;
+    int dirty;        // L'inode doit être réécrit à la fermeture
+};
+
+// Chemin suivi de la racine de l'index jusqu'à une feuille
+struct dx_path {
+    int levels;
+    int node;         // Noeud intermédiaire traversé si levels == 1
+    int pos[2];       // Entrée suivie dans la racine puis dans le noeud
+    int leaf;
+};
+
+/**
+ * Ouvre un répertoire
+ *
+ * @param d Descripteur à remplir, ne doit pas être copié ensuite
+ * @param inum Inode du répertoire
+ * @return vrai si l'inode est un répertoire valide
+ */
+static int dirh_open(struct sgf_mount *fs, struct fs_dirh *d, int inum) {
+    if (!inode_load(fs, inum, &d->inode) || !(d->inode.isvalid & INODE_DIR)) {
+        return 0;
+    }
+    d->inum = inum;
+    d->dirty = 0;
+    map_init(&d->map, &d->inode);
+    return 1;
+}
+
+static void dirh_read(struct sgf_mount *fs, struct fs_dirh *d, int index, union fs_block *blk) {
+    bloc_read(fs, map_get(fs, &d->map, index), blk->data);
+}
+
+static void dirh_write(struct sgf_mount *fs, struct fs_dirh *d, int index, union fs_block *blk) {
+    bloc_write(fs, map_get(fs, &d->map, index), blk->data);
+}
+
+/**
+ * Ajoute un bloc à la fin du répertoire
+ *
+ * @param d Répertoire ouvert
+ * @param blk Contenu du nouveau bloc
+ * @return Index du bloc dans le répertoire, -1 si le disque est plein
+ */
+static int dirh_append(struct sgf_mount *fs, struct fs_dirh *d, union fs_block *blk) {
+    int index = d->inode.size / BLOCK_SIZE;
+    int ptr = get_bloc(fs);
+    if (ptr == -1) {
+        printf("Taille insuffisante\n");
+        return -1;
+    }
+    if (!map_set(fs, &d->map, index, ptr)) {
+        bitmap_release(fs, ptr);
+        printf("Taille insuffisante\n");
+        return -1;
+    }
+    bloc_write(fs, ptr, blk->data);
+    d->inode.size += BLOCK_SIZE;
+    d->dirty = 1;
+    return index;
+}
+
+static void dirh_close(struct sgf_mount *fs, struct fs_dirh *d) {
+    map_flush(fs, &d->map);
+    if (d->dirty)
+        inode_store(fs, d->inum, &d->inode);
+}
+
+/**
+ * Hachage FNV-1a d'un nom, sur 31 bits
+ */
+static unsigned int dir_hash(const char *name) {
+    unsigned int hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
+    return hash & 0x7fffffff;
+}
+
+/**
+ * Dernière entrée d'un bloc d'index couvrant le hachage.
+ * La première entrée couvre tous les hachages inférieurs.
+ */
+static int dx_search(struct fs_dxblock *dx, unsigned int hash) {
+    int lo = 0, hi = dx->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (dx->entries[mid].hash <= hash)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+static void dx_insert_at(struct fs_dxblock *dx, int pos, unsigned int hash, int block) {
+    memmove(&dx->entries[pos + 1], &dx->entries[pos], (dx->count - pos) * sizeof(struct fs_dxentry));
+    dx->entries[pos].hash = hash;
+    dx->entries[pos].block = block;
+    dx->count++;
+}
+
+/**
+ * Descend l'index d'un répertoire jusqu'à la feuille couvrant le hachage
+ */
+static void dx_lookup(struct sgf_mount *fs, struct fs_dirh *d, unsigned int hash, struct dx_path *path) {
+    union fs_block blk;
+    dirh_read(fs, d, 0, &blk);
+    path->levels = blk.dx.levels;
+    path->pos[0] = dx_search(&blk.dx, hash);
+    path->leaf = blk.dx.entries[path->pos[0]].block;
+    if (path->levels == 1) {
+        path->node = path->leaf;
+        dirh_read(fs, d, path->node, &blk);
+        path->pos[1] = dx_search(&blk.dx, hash);
+        path->leaf = blk.dx.entries[path->pos[1]].block;
+    }
+}
+
+/**
+ * Transforme un répertoire linéaire plein en répertoire indexé : ses entrées
+ * sont déplacées dans une feuille et le bloc 0 devient la racine de l'index.
+ *
+ * @param d Répertoire ouvert, limité à un bloc
+ * @return vrai en cas de succès
+ */
+static int dx_convert(struct sgf_mount *fs, struct fs_dirh *d) {
+    union fs_block blk;
+    dirh_read(fs, d, 0, &blk);
+    int leaf = dirh_append(fs, d, &blk);
+    if (leaf == -1) {
+        return 0;
+    }
+
+    memset(blk.data, 0, BLOCK_SIZE);
+    blk.dx.magic = DX_MAGIC;
+    blk.dx.levels = 0;
+    blk.dx.count = 1;
+    blk.dx.entries[0].hash = 0;
+    blk.dx.entries[0].block = leaf;
+    dirh_write(fs, d, 0, &blk);
+
+    d->inode.isvalid |= INODE_INDEX;
+    d->dirty = 1;
+    return 1;
+}
+
+/**
+ * Ajoute au parent d'une feuille coupée l'entrée d'index de sa nouvelle moitié.
+ * Une racine pleine descend dans un noeud intermédiaire, un noeud plein est coupé en deux.
+ *
+ * @param d Répertoire ouvert
+ * @param path Chemin vers la feuille coupée
+ * @param hash Premier hachage de la nouvelle feuille
+ * @param block Index de la nouvelle feuille
+ * @return vrai en cas de succès
+ */
+static int dx_add_index(struct sgf_mount *fs, struct fs_dirh *d, struct dx_path *path, unsigned int hash, int block) {
+    union fs_block root, node, upper;
+    dirh_read(fs, d, 0, &root);
+
+    if (root.dx.levels == 0) {
+        if (root.dx.count < DX_ENTRIES) {
+            dx_insert_at(&root.dx, path->pos[0] + 1, hash, block);
+            dirh_write(fs, d, 0, &root);
+            return 1;
+        }
+
+        // Racine pleine : ses entrées passent dans un noeud intermédiaire
+        int n = dirh_append(fs, d, &root);
+        if (n == -1) {
+            return 0;
+        }
+        root.dx.levels = 1;
+        root.dx.count = 1;
+        root.dx.entries[0].hash = 0;
+        root.dx.entries[0].block = n;
+        dirh_write(fs, d, 0, &root);
+
+        path->levels = 1;
+        path->node = n;
+        path->pos[1] = path->pos[0];
+        path->pos[0] = 0;
+    }
+
+    dirh_read(fs, d, path->node, &node);
+    node.dx.levels = 0;
+    if (node.dx.count < DX_ENTRIES) {
+        dx_insert_at(&node.dx, path->pos[1] + 1, hash, block);
+        dirh_write(fs, d, path->node, &node);
+        return 1;
+    }
+
+    // Noeud plein : déplacer sa moitié haute dans un nouveau noeud
+    if (root.dx.count >= DX_ENTRIES) {
+        printf("Répertoire plein\n");
+        return 0;
+    }
+    int half = node.dx.count / 2;
+    memset(upper.data, 0, BLOCK_SIZE);
+    upper.dx.magic = DX_MAGIC;
+    upper.dx.count = node.dx.count - half;
+    memcpy(upper.dx.entries, &node.dx.entries[half], upper.dx.count * sizeof(struct fs_dxentry));
+    node.dx.count = half;
+
+    int pos = path->pos[1] + 1;
+    if (pos <= half)
+        dx_insert_at(&node.dx, pos, hash, block);
+    else
+        dx_insert_at(&upper.dx, pos - half, hash, block);
+
+    int n = dirh_append(fs, d, &upper);
+    if (n == -1) {
+        return 0;
+    }
+    dirh_write(fs, d, path->node, &node);
+    dx_insert_at(&root.dx, path->pos[0] + 1, upper.dx.entries[0].hash, n);
+    dirh_write(fs, d, 0, &root);
+    return 1;
+}
+
+// Entrée d'une feuille à partager, repérée par sa position dans l'ancienne feuille
+struct dx_sorted {
+    unsigned int hash;
+    int off;          // -1 pour l'entrée ajoutée
+    int len;          // Taille minimale de son enregistrement
+};
+
+static int compare_dx_sorted(const void *a, const void *b) {
+    unsigned int x = ((const struct dx_sorted *) a)->hash;
+    unsigned int y = ((const struct dx_sorted *) b)->hash;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Ajoute une entrée dans la feuille d'un répertoire indexé couvrant son hachage.
+ * Une feuille pleine est partagée en deux selon les hachages de ses entrées.
+ *
+ * @param d Répertoire ouvert et indexé
+ * @param entry Entrée à ajouter
+ * @return Position de l'entrée, -1 en cas d'erreur
+ */
+static int dx_insert(struct sgf_mount *fs, struct fs_dirh *d, struct fs_dirent *entry) {
+    unsigned int hash = dir_hash(entry->name);
+    struct dx_path path;
+    union fs_block blk, lower, upper;
+    dx_lookup(fs, d, hash, &path);
+
+    dirh_read(fs, d, path.leaf, &blk);
+    int off = dirblk_add(&blk, entry);
+    if (off != -1) {
+        dirh_write(fs, d, path.leaf, &blk);
+        return path.leaf * BLOCK_SIZE + off;
+    }
+
+    // Feuille pleine : trier ses entrées par hachage et couper vers la moitié de leur volume,
+    // entre deux hachages distincts
+    struct dx_sorted all[BLOCK_SIZE / DIRREC_LEN(1) + 1];
+    struct fs_dirent temp;
+    int n = 0, total = 0;
+    for (off = 0; off < BLOCK_SIZE; off = dirblk_next(&blk, off)) {
+        struct fs_dirrec *rec = DIRREC_AT(&blk, off);
+        if (rec->inum == 0)
+            continue;
+        dirrec_decode(rec, &temp);
+        all[n].hash = dir_hash(temp.name);
+        all[n].off = off;
+        all[n].len = DIRREC_LEN(rec->name_len);
+        total += all[n++].len;
+    }
+    all[n].hash = hash;
+    all[n].off = -1;
+    all[n].len = DIRREC_LEN(strlen(entry->name));
+    total += all[n++].len;
+    qsort(all, n, sizeof(struct dx_sorted), compare_dx_sorted);
+
+    int half = 0, bytes = 0;
+    while (half < n - 1 && bytes + all[half].len <= total / 2)
+        bytes += all[half++].len;
+    if (half == 0)
+        half = 1;
+    int split = half;
+    while (split < n && all[split].hash == all[split - 1].hash)
+        split++;
+    if (split == n) {
+        split = half;
+        while (split > 0 && all[split].hash == all[split - 1].hash)
+            split--;
+    }
+    if (split == 0) {
+        printf("Répertoire plein\n");
+        return -1;
+    }
+
+    dirblk_init(&lower);
+    dirblk_init(&upper);
+    int pos = -1;
+    for (int i = 0; i < n; i++) {
+        if (all[i].off == -1)
+            temp = *entry;
+        else
+            dirrec_decode(DIRREC_AT(&blk, all[i].off), &temp);
+        off = dirblk_add(i < split ? &lower : &upper, &temp);
+        if (off == -1) {
+            printf("Répertoire plein\n");
+            return -1;
+        }
+        if (all[i].off == -1)
+            pos = off;
+    }
+
+    int block = dirh_append(fs, d, &upper);
+    if (block == -1) {
+        return -1;
+    }
+    if (!dx_add_index(fs, d, &path, all[split].hash, block)) {
+        return -1;
+    }
+    dirh_write(fs, d, path.leaf, &lower);
+
+    for (int i = 0; i < n; i++) {
+        if (all[i].off == -1)
+            return (i < split ? path.leaf : block) * BLOCK_SIZE + pos;
+    }
+    return -1;
+}
+
+/**
+ * Entrée du cache des noms associée à un nom dans un répertoire
+ */
+static struct fs_dentry *dcache_slot(struct sgf_mount *fs, int parent, const char *name) {
+    unsigned int hash = dir_hash(name) ^ ((unsigned int) parent * 2654435761u);
+    return &fs->dcache[hash % DCACHE_SIZE];
+}
+
+// Remplit une entrée du cache des noms, dans une section d'écriture de son compteur
+static void dentry_set(struct fs_dentry *de, int parent, const char *name, struct fs_dirent *entry) {
+    WRITE_ONCE(de->parent, parent);
+    WRITE_ONCE(de->inum, entry ? entry->inum : 0);
+    WRITE_ONCE(de->type, entry ? entry->type : 0);
+    int i = 0;
+    do {
+        WRITE_ONCE(de->name[i], name[i]);
+    } while (name[i++] != '\0');
+}
+
+/**
+ * Cherche un nom dans le cache, sans verrou : la lecture recommence si l'entrée
+ * a été modifiée pendant ce temps
+ *
+ * @param parent Inode du répertoire
+ * @param name Nom cherché
+ * @param entry Reçoit l'entrée si le nom est présent
+ * @return 1 si le nom est présent, 0 s'il est connu absent, -1 s'il n'est pas dans le cache
+ */
+static int dcache_lookup(struct sgf_mount *fs, int parent, const char *name, struct fs_dirent *entry) {
+    if (fs->dcache == NULL || strlen(name) >= NAMESIZE) {
+        return -1;
+    }
+    struct fs_dentry *de = dcache_slot(fs, parent, name);
+    int match, inum, type;
+    unsigned int start;
+    do {
+        start = seq_read_begin(&de->seq);
+        int i = 0;
+        while (name[i] != '\0' && READ_ONCE(de->name[i]) == name[i])
+            i++;
+        match = name[i] == '\0' && READ_ONCE(de->name[i]) == '\0' && READ_ONCE(de->parent) == parent;
+        inum = READ_ONCE(de->inum);
+        type = READ_ONCE(de->type);
+    } while (!seq_read_valid(&de->seq, start));
+
+    if (!match) {
+        return -1;
+    }
+    if (inum != 0) {
+        memset(entry, 0, sizeof(*entry));
+        entry->isvalid = 1;
+        entry->inum = inum;
+        entry->type = type;
+        strcpy(entry->name, name);
+    }
+    return inum != 0;
+}
+
+/**
+ * Enregistre le résultat d'une recherche, positive ou négative
+ *
+ * @param parent Inode du répertoire
+ * @param name Nom cherché
+ * @param entry Entrée trouvée, NULL si le nom est absent
+ */
+static void dcache_store(struct sgf_mount *fs, int parent, const char *name, struct fs_dirent *entry) {
+    if (fs->dcache == NULL || strlen(name) >= NAMESIZE) {
+        return;
+    }
+    struct fs_dentry *de = dcache_slot(fs, parent, name);
+    seq_write_begin(&de->seq);
+    dentry_set(de, parent, name, entry);
+    seq_write_end(&de->seq);
+}
+
+/**
+ * Enregistre le résultat d'une recherche sans verrou, sauf si la structure qui l'a donné
+ * a changé depuis. Une modification du répertoire met cette structure à jour avant
+ * le cache des noms : un résultat périmé ne peut donc pas écraser le sien.
+ *
+ * @param seq Compteur de séquence de la structure lue
+ * @param start Valeur du compteur au début de la lecture
+ */
+static void dcache_publish(struct sgf_mount *fs, int parent, const char *name, struct fs_dirent *entry,
+                           const unsigned int *seq, unsigned int start) {
+    if (fs->dcache == NULL || strlen(name) >= NAMESIZE) {
+        return;
+    }
+    struct fs_dentry *de = dcache_slot(fs, parent, name);
+    seq_write_begin(&de->seq);
+    if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) == start)
+        dentry_set(de, parent, name, entry);
+    seq_write_end(&de->seq);
+}
+
+/**
+ * Oublie tous les noms cachés d'un répertoire supprimé, son inode pouvant être réutilisé
+ *
+ * @param parent Inode du répertoire
+ */
+static void dcache_forget_dir(struct sgf_mount *fs, int parent) {
+    if (fs->dcache == NULL) {
+        return;
+    }
+    for (int i = 0; i < DCACHE_SIZE; i++) {
+        struct fs_dentry *de = &fs->dcache[i];
+        if (READ_ONCE(de->parent) != parent)
+            continue;
+        seq_write_begin(&de->seq);
+        if (de->parent == parent)
+            WRITE_ONCE(de->parent, 0);
+        seq_write_end(&de->seq);
+    }
+}
+
+/**
+ * Masque des emplacements d'un groupe dont le hachage est égal à celui cherché.
+ * Sous ThreadSanitizer, qui ne connaît pas les chargements vectoriels concurrents
+ * d'une écriture, les hachages sont lus un à un par des chargements atomiques.
+ *
+ * @param hashes Hachages des 8 emplacements du groupe, alignés sur 32 octets
+ * @param hash Hachage cherché
+ */
+static unsigned int dircache_match8(const unsigned int *hashes, unsigned int hash) {
+#if defined(__AVX2__) && !defined(__SANITIZE_THREAD__)
+    __m256i eq = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *) hashes), _mm256_set1_epi32(hash));
+    return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+#elif defined(__SSE2__) && !defined(__SANITIZE_THREAD__)
+    __m128i key = _mm_set1_epi32(hash);
+    __m128i lo = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) hashes), key);
+    __m128i hi = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (hashes + 4)), key);
+    return _mm_movemask_ps(_mm_castsi128_ps(lo)) | (_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4);
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < 8; i++)
+        mask |= (unsigned int) (READ_ONCE(hashes[i]) == hash) << i;
+    return mask;
+#endif
+}
+
+/**
+ * Cherche un nom dans un répertoire en cache. Les groupes sont sondés à partir de celui
+ * désigné par le hachage, jusqu'au premier groupe ayant un emplacement jamais utilisé.
+ * Sans dircache_lock, dc est une copie des champs validée par le compteur de séquence.
+ *
+ * @return Emplacement de l'entrée, -1 si le nom est absent
+ */
+static int dircache_find(const struct fs_dircache *dc, const char *name) {
+    unsigned int hash = dir_hash(name);
+    int groups = dc->capacity / 8;
+    int g = hash & (groups - 1);
+    for (int probe = 0; probe < groups; probe++) {
+        unsigned int mask = dircache_match8(&dc->hashes[g * 8], hash) & DIRCACHE_GROUP(dc->valid, g);
+        while (mask) {
+            int slot = g * 8 + __builtin_ctz(mask);
+            if (streq(READ_PTR(dc->names[slot]), name)) {
+                return slot;
+            }
+            mask &= mask - 1;
+        }
+        if (DIRCACHE_GROUP(dc->used, g) != 0xff) {
+            break;
+        }
+        g = (g + 1) & (groups - 1);
+    }
+    return -1;
+}
+
+/**
+ * Place une entrée dans le premier emplacement non occupé de sa suite de sondage.
+ * Le nom est publié avant le bit de l'emplacement, qu'un lecteur sans verrou teste d'abord.
+ * Les rédacteurs étant sérialisés, les bits sont écrits sans instruction atomique de lecture-modification.
+ */
+static void dircache_place(struct fs_dircache *dc, unsigned int hash, int inum, int type, char *name) {
+    int groups = dc->capacity / 8;
+    int g = hash & (groups - 1);
+    unsigned int free;
+    while ((free = ~DIRCACHE_GROUP(dc->valid, g) & 0xff) == 0)
+        g = (g + 1) & (groups - 1);
+
+    int slot = g * 8 + __builtin_ctz(free);
+    uint64_t bit = (uint64_t) 1 << (slot % 64);
+    if (!(dc->used[slot / 64] & bit)) {
+        __atomic_store_n(&dc->used[slot / 64], dc->used[slot / 64] | bit, __ATOMIC_RELEASE);
+        dc->nused++;
+    }
+    WRITE_ONCE(dc->hashes[slot], hash);
+    WRITE_ONCE(dc->inums[slot], inum);
+    WRITE_ONCE(dc->types[slot], type);
+    PUBLISH_PTR(dc->names[slot], name);
+    __atomic_store_n(&dc->valid[slot / 64], dc->valid[slot / 64] | bit, __ATOMIC_RELEASE);
+    dc->nvalid++;
+}
+
+/**
+ * Libère les tableaux d'un répertoire en cache, et les noms qu'ils désignent si names est vrai
+ */
+static void dircache_destroy(struct fs_dircache *dc, int names) {
+    for (int i = 0; names && i < dc->capacity; i++) {
+        if (dc->valid[i / 64] & ((uint64_t) 1 << (i % 64)))
+            free(dc->names[i]);
+    }
+    free(dc->hashes);
+    free(dc->inums);
+    free(dc->types);
+    free(dc->names);
+    free(dc->valid);
+    free(dc->used);
+}
+
+// Libérations différées par epoch_retire des tableaux retirés d'un répertoire en cache
+static void dircache_release(void *p) {
+    dircache_destroy(p, 1);
+    free(p);
+}
+
+static void dircache_release_arrays(void *p) {
+    dircache_destroy(p, 0);
+    free(p);
+}
+
+// Copie les tableaux d'un répertoire en cache, sans les champs que les lecteurs modifient
+static void dircache_arrays(struct fs_dircache *to, const struct fs_dircache *dc) {
+    memset(to, 0, sizeof(*to));
+    to->capacity = dc->capacity;
+    to->hashes = dc->hashes;
+    to->inums = dc->inums;
+    to->types = dc->types;
+    to->names = dc->names;
+    to->valid = dc->valid;
+    to->used = dc->used;
+}
+
+/**
+ * Réorganise un répertoire en cache dans des tableaux de la capacité donnée,
+ * les emplacements effacés disparaissent. Les nouveaux tableaux sont remplis avant
+ * d'être publiés, les anciens sont retirés. L'appelant tient dircache_lock et
+ * a rendu impair le compteur de séquence du répertoire s'il est visible des lecteurs.
+ *
+ * @return vrai en cas de succès, faux si la mémoire manque
+ */
+static int dircache_resize(struct sgf_mount *fs, struct fs_dircache *dc, int capacity) {
+    struct fs_dircache next;
+    memset(&next, 0, sizeof(next));
+    next.capacity = capacity;
+    next.hashes = aligned_alloc(32, capacity * sizeof(unsigned int));
+    next.inums = malloc(capacity * sizeof(int));
+    next.types = malloc(capacity);
+    next.names = malloc(capacity * sizeof(char *));
+    next.valid = calloc(capacity / 64, sizeof(uint64_t));
+    next.used = calloc(capacity / 64, sizeof(uint64_t));
+    struct fs_dircache *old = malloc(sizeof(struct fs_dircache));
+    if (!next.hashes || !next.inums || !next.types || !next.names || !next.valid || !next.used || !old) {
+        dircache_destroy(&next, 0);
+        free(old);
+        return 0;
+    }
+
+    dircache_arrays(old, dc);
+    for (int i = 0; i < old->capacity; i++) {
+        if (old->valid[i / 64] & ((uint64_t) 1 << (i % 64)))
+            dircache_place(&next, old->hashes[i], old->inums[i], old->types[i], old->names[i]);
+    }
+    WRITE_ONCE(dc->capacity, capacity);
+    PUBLISH_PTR(dc->hashes, next.hashes);
+    PUBLISH_PTR(dc->inums, next.inums);
+    PUBLISH_PTR(dc->types, next.types);
+    PUBLISH_PTR(dc->names, next.names);
+    PUBLISH_PTR(dc->valid, next.valid);
+    PUBLISH_PTR(dc->used, next.used);
+    dc->nvalid = next.nvalid;
+    dc->nused = next.nused;
+    if (old->hashes != NULL)
+        epoch_retire(fs, old, dircache_release_arrays);
+    else
+        free(old);
+    return 1;
+}
+
+/**
+ * Ajoute une entrée dans un répertoire en cache, agrandi au-delà de 7/8 d'emplacements utilisés
+ *
+ * @return vrai en cas de succès, faux si la mémoire manque
+ */
+static int dircache_add(struct sgf_mount *fs, struct fs_dircache *dc, struct fs_dirent *entry) {
+    char *name = strdup(entry->name);
+    if (name == NULL) {
+        return 0;
+    }
+
+    int ok = 1;
+    seq_write_begin(&dc->seq);
+    if ((dc->nused + 1) * 8 > dc->capacity * 7) {
+        int capacity = 64;
+        while (capacity < (dc->nvalid + 1) * 2)
+            capacity *= 2;
+        ok = dircache_resize(fs, dc, capacity);
+    }
+    if (ok)
+        dircache_place(dc, dir_hash(name), entry->inum, entry->type, name);
+    seq_write_end(&dc->seq);
+    if (!ok)
+        free(name);
+    return ok;
+}
+
+static void dircache_remove(struct sgf_mount *fs, struct fs_dircache *dc, int slot) {
+    seq_write_begin(&dc->seq);
+    __atomic_store_n(&dc->valid[slot / 64], dc->valid[slot / 64] & ~((uint64_t) 1 << (slot % 64)), __ATOMIC_RELEASE);
+    dc->nvalid--;
+    seq_write_end(&dc->seq);
+    epoch_retire(fs, dc->names[slot], free);
+}
+
+/**
+ * Libère un répertoire en cache : il disparaît pour les nouvelles lectures,
+ * ses tableaux et ses noms sont retirés
+ */
+static void dircache_free(struct sgf_mount *fs, struct fs_dircache *dc) {
+    struct fs_dircache arrays;
+    seq_write_begin(&dc->seq);
+    dircache_arrays(&arrays, dc);
+    WRITE_ONCE(dc->inum, 0);
+    WRITE_ONCE(dc->capacity, 0);
+    PUBLISH_PTR(dc->hashes, NULL);
+    PUBLISH_PTR(dc->inums, NULL);
+    PUBLISH_PTR(dc->types, NULL);
+    PUBLISH_PTR(dc->names, NULL);
+    PUBLISH_PTR(dc->valid, NULL);
+    PUBLISH_PTR(dc->used, NULL);
+    dc->nvalid = 0;
+    dc->nused = 0;
+    seq_write_end(&dc->seq);
+    if (arrays.hashes == NULL) {
+        return;
+    }
+
+    struct fs_dircache *old = malloc(sizeof(struct fs_dircache));
+    if (old != NULL) {
+        *old = arrays;
+        epoch_retire(fs, old, dircache_release);
+    } else {
+        epoch_synchronize(fs);
+        dircache_destroy(&arrays, 1);
+    }
+}
+
+/**
+ * Position du i-ème bit d'un nom dans un filtre de Bloom de nbits bits, par double hachage
+ */
+static int dirbloom_bit(int nbits, unsigned int hash, int i) {
+    unsigned int step = ((hash * 0x9e3779b1u) ^ (hash >> 15)) | 1;
+    return (hash + i * step) & (nbits - 1);
+}
+
+static void dirbloom_set(uint64_t *bits, int nbits, unsigned int hash) {
+    for (int i = 0; i < DIRBLOOM_PROBES; i++) {
+        int bit = dirbloom_bit(nbits, hash, i);
+        WRITE_ONCE(bits[bit / 64], bits[bit / 64] | ((uint64_t) 1 << (bit % 64)));
+    }
+}
+
+/**
+ * Construit le filtre de Bloom d'un répertoire à partir de sa copie en mémoire.
+ * Le filtre est rempli avant d'être publié, l'ancien est retiré.
+ */
+static void dirbloom_build(struct sgf_mount *fs, struct fs_dircache *dc) {
+    if (fs->dirblooms == NULL) {
+        return;
+    }
+    struct fs_dirbloom *bf = &fs->dirblooms[dc->inum % DIRBLOOM_DIRS];
+    int nbits = 1024;
+    while (nbits < dc->nvalid * 16)
+        nbits *= 2;
+    uint64_t *bits = calloc(nbits / 64, sizeof(uint64_t));
+    for (int i = 0; bits != NULL && i < dc->capacity; i++) {
+        if (dc->valid[i / 64] & ((uint64_t) 1 << (i % 64)))
+            dirbloom_set(bits, nbits, dc->hashes[i]);
+    }
+
+    uint64_t *old = bf->bits;
+    seq_write_begin(&bf->seq);
+    WRITE_ONCE(bf->inum, bits != NULL ? dc->inum : 0);
+    WRITE_ONCE(bf->nbits, nbits);
+    PUBLISH_PTR(bf->bits, bits);
+    bf->count = bits != NULL ? dc->nvalid : 0;
+    seq_write_end(&bf->seq);
+    if (old != NULL)
+        epoch_retire(fs, old, free);
+}
+
+/**
+ * Filtre de Bloom d'un répertoire, NULL s'il n'en a pas. Doit être appelé avec dircache_lock.
+ */
+static struct fs_dirbloom *dirbloom_get(struct sgf_mount *fs, int inum) {
+    if (fs->dirblooms == NULL || fs->dirblooms[inum % DIRBLOOM_DIRS].inum != inum) {
+        return NULL;
+    }
+    return &fs->dirblooms[inum % DIRBLOOM_DIRS];
+}
+
+/**
+ * Vérifie avec le filtre de Bloom qu'un nom est absent d'un répertoire
+ *
+ * @return vrai si le nom est sûrement absent, faux s'il peut être présent ou si le répertoire n'a pas de filtre
+ */
+static int dirbloom_absent(struct sgf_mount *fs, int inum, const char *name) {
+    struct fs_dirbloom *bf = dirbloom_get(fs, inum);
+    if (bf == NULL) {
+        return 0;
+    }
+    unsigned int hash = dir_hash(name);
+    for (int i = 0; i < DIRBLOOM_PROBES; i++) {
+        int bit = dirbloom_bit(bf->nbits, hash, i);
+        if (!(bf->bits[bit / 64] & ((uint64_t) 1 << (bit % 64))))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Cherche sans verrou un nom dans le filtre de Bloom d'un répertoire, dans une époque de lecture.
+ * Un nom sûrement absent est enregistré dans le cache des noms.
+ *
+ * @return 0 si le nom est sûrement absent, -1 s'il peut être présent ou si le filtre a changé
+ */
+static int dirbloom_lookup(struct sgf_mount *fs, int parent, const char *name) {
+    if (fs->dirblooms == NULL) {
+        return -1;
+    }
+    struct fs_dirbloom *bf = &fs->dirblooms[parent % DIRBLOOM_DIRS];
+    unsigned int start = seq_read_begin(&bf->seq);
+    int nbits = READ_ONCE(bf->nbits);
+    uint64_t *bits = READ_PTR(bf->bits);
+    if (READ_ONCE(bf->inum) != parent || bits == NULL || !seq_read_valid(&bf->seq, start)) {
+        return -1;
+    }
+
+    unsigned int hash = dir_hash(name);
+    int absent = 0;
+    for (int i = 0; i < DIRBLOOM_PROBES && !absent; i++) {
+        int bit = dirbloom_bit(nbits, hash, i);
+        absent = !(READ_ONCE(bits[bit / 64]) & ((uint64_t) 1 << (bit % 64)));
+    }
+    if (!absent || !seq_read_valid(&bf->seq, start)) {
+        return -1;
+    }
+    dcache_publish(fs, parent, name, NULL, &bf->seq, start);
+    return 0;
+}
+
+static void dirbloom_drop(struct sgf_mount *fs, int inum) {
+    struct fs_dirbloom *bf = dirbloom_get(fs, inum);
+    if (bf == NULL) {
+        return;
+    }
+    uint64_t *old = bf->bits;
+    seq_write_begin(&bf->seq);
+    WRITE_ONCE(bf->inum, 0);
+    WRITE_ONCE(bf->nbits, 0);
+    PUBLISH_PTR(bf->bits, NULL);
+    bf->count = 0;
+    seq_write_end(&bf->seq);
+    epoch_retire(fs, old, free);
+}
+
+/**
+ * Ajoute un nom au filtre de Bloom d'un répertoire. Un filtre trop rempli est abandonné,
+ * il sera reconstruit au prochain chargement du répertoire.
+ */
+static void dirbloom_add(struct sgf_mount *fs, int inum, const char *name) {
+    struct fs_dirbloom *bf = dirbloom_get(fs, inum);
+    if (bf == NULL) {
+        return;
+    }
+    if (bf->count * 10 >= bf->nbits) {
+        dirbloom_drop(fs, inum);
+        return;
+    }
+    seq_write_begin(&bf->seq);
+    dirbloom_set(bf->bits, bf->nbits, dir_hash(name));
+    bf->count++;
+    seq_write_end(&bf->seq);
+}
+
+/**
+ * Répertoire en cache, NULL s'il n'y est pas. Doit être appelé avec dircache_lock.
+ */
+static struct fs_dircache *dircache_get(struct sgf_mount *fs, int inum) {
+    if (fs->dircaches == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < DIRCACHE_DIRS; i++) {
+        if (fs->dircaches[i].inum == inum) {
+            __atomic_store_n(&fs->dircaches[i].last, __atomic_add_fetch(&fs->dircache_tick, 1, __ATOMIC_RELAXED),
+                             __ATOMIC_RELAXED);
+            return &fs->dircaches[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Charge toutes les entrées d'un répertoire en cache, à la place du répertoire le moins récemment utilisé.
+ * Doit être appelé avec dircache_lock. Le répertoire n'est visible des lecteurs sans verrou
+ * qu'une fois rempli.
+ *
+ * @param inum Inode du répertoire
+ * @return Répertoire en cache, NULL en cas d'erreur
+ */
+static struct fs_dircache *dircache_load(struct sgf_mount *fs, int inum) {
+    struct fs_dirh d;
+    if (fs->dircaches == NULL || !dirh_open(fs, &d, inum)) {
+        return NULL;
+    }
+
+    struct fs_dircache *dc = &fs->dircaches[0];
+    for (int i = 1; i < DIRCACHE_DIRS; i++) {
+        if (__atomic_load_n(&fs->dircaches[i].last, __ATOMIC_RELAXED) < __atomic_load_n(&dc->last, __ATOMIC_RELAXED))
+            dc = &fs->dircaches[i];
+    }
+    dircache_free(fs, dc);
+    if (!dircache_resize(fs, dc, 64)) {
+        return NULL;
+    }
+
+    union fs_block blk;
+    struct fs_dirent entry;
+    for (int index = 0; index < d.inode.size / BLOCK_SIZE; index++) {
+        dirh_read(fs, &d, index, &blk);
+        if (blk.dx.magic == DX_MAGIC)
+            continue;
+        for (int off = 0; off < BLOCK_SIZE; off = dirblk_next(&blk, off)) {
+            if (DIRREC_AT(&blk, off)->inum == 0)
+                continue;
+            dirrec_decode(DIRREC_AT(&blk, off), &entry);
+            if (!dircache_add(fs, dc, &entry)) {
+                dircache_free(fs, dc);
+                return NULL;
+            }
+        }
+    }
+    seq_write_begin(&dc->seq);
+    WRITE_ONCE(dc->inum, inum);
+    seq_write_end(&dc->seq);
+    __atomic_store_n(&dc->last, __atomic_add_fetch(&fs->dircache_tick, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    dirbloom_build(fs, dc);
+    return dc;
+}
+
+/**
+ * Retire un répertoire du cache, son inode pouvant être réutilisé
+ */
+static void dircache_drop(struct sgf_mount *fs, int inum) {
+    struct fs_dircache *dc = dircache_get(fs, inum);
+    if (dc)
+        dircache_free(fs, dc);
+}
+
+/**
+ * Cherche sans verrou un nom dans la copie en mémoire d'un répertoire, à défaut dans son
+ * filtre de Bloom. La lecture se fait dans une époque : la mémoire retirée par un rédacteur
+ * pendant ce temps reste valide jusqu'à sa fin.
+ *
+ * @param parent Inode du répertoire
+ * @param name Nom cherché
+ * @param entry Reçoit l'entrée si le nom est présent
+ * @return 1 si le nom est présent, 0 s'il est absent, -1 si le répertoire n'est pas en cache
+ *         ou s'il a changé pendant la lecture
+ */
+static int dircache_lookup(struct sgf_mount *fs, int parent, const char *name, struct fs_dirent *entry) {
+    if (fs->dircaches == NULL) {
+        return -1;
+    }
+    struct fs_reader *r = epoch_enter(fs);
+    struct fs_dircache *dc = NULL;
+    for (int i = 0; i < DIRCACHE_DIRS && dc == NULL; i++) {
+        if (READ_ONCE(fs->dircaches[i].inum) == parent)
+            dc = &fs->dircaches[i];
+    }
+    if (dc == NULL) {
+        int hit = dirbloom_lookup(fs, parent, name);
+        epoch_exit(r);
+        return hit;
+    }
+
+    int hit = -1;
+    struct fs_dircache snap;
+    unsigned int start = seq_read_begin(&dc->seq);
+    snap.inum = READ_ONCE(dc->inum);
+    snap.capacity = READ_ONCE(dc->capacity);
+    snap.hashes = READ_PTR(dc->hashes);
+    snap.inums = READ_PTR(dc->inums);
+    snap.types = READ_PTR(dc->types);
+    snap.names = READ_PTR(dc->names);
+    snap.valid = READ_PTR(dc->valid);
+    snap.used = READ_PTR(dc->used);
+    // Les tableaux ne sont parcourus qu'une fois leur cohérence avec capacity vérifiée
+    if (snap.inum == parent && snap.hashes != NULL && seq_read_valid(&dc->seq, start)) {
+        int slot = dircache_find(&snap, name);
+        int inum = slot != -1 ? READ_ONCE(snap.inums[slot]) : 0;
+        int type = slot != -1 ? READ_ONCE(snap.types[slot]) : 0;
+        if (seq_read_valid(&dc->seq, start)) {
+            __atomic_store_n(&dc->last, __atomic_add_fetch(&fs->dircache_tick, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+            hit = slot != -1;
+            if (hit) {
+                memset(entry, 0, sizeof(*entry));
+                entry->isvalid = 1;
+                entry->inum = inum;
+                entry->type = type;
+                strcpy(entry->name, name);
+            }
+            dcache_publish(fs, parent, name, hit ? entry : NULL, &dc->seq, start);
+        }
+    }
+    epoch_exit(r);
+    return hit;
+}
+
+/**
+ * Cherche une entrée valide par son nom dans un répertoire.
+ * Dans un répertoire indexé, seule la feuille couvrant le hachage du nom est lue.
+ *
+ * @param dir_inum Inode du répertoire
+ * @param name Nom du fichier/répertoire
+ * @param entry Reçoit l'entrée trouvée, peut être NULL
+ * @return Position de l'entrée dans le répertoire, -1 si absente
+ */
+static int dir_find(struct sgf_mount *fs, int dir_inum, const char *name, struct fs_dirent *entry) {
+    struct fs_dirh d;
+    if (!dirh_open(fs, &d, dir_inum)) {
+        return -1;
+    }
+
+    int first = 0, last = d.inode.size / BLOCK_SIZE;
+    if (d.inode.isvalid & INODE_INDEX) {
+        struct dx_path path;
+        dx_lookup(fs, &d, dir_hash(name), &path);
+        first = path.leaf;
+        last = path.leaf + 1;
+    }
+
+    union fs_block blk;
+    for (int index = first; index < last; index++) {
+        dirh_read(fs, &d, index, &blk);
+        if (blk.dx.magic == DX_MAGIC)
+            continue;
+        int off = dirblk_find(&blk, name, entry);
+        if (off != -1) {
+            return index * BLOCK_SIZE + off;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Lit l'entrée d'un répertoire à la position donnée
+ *
+ * @param dir_inum Inode du répertoire
+ * @param slot Position de l'entrée
+ * @param entry Reçoit l'entrée
+ * @return vrai si l'entrée existe et est valide
+ */
+static int dir_entry_at(struct sgf_mount *fs, int dir_inum, int slot, struct fs_dirent *entry) {
+    struct fs_dirh d;
+    if (slot < 0 || !dirh_open(fs, &d, dir_inum) || slot / BLOCK_SIZE >= d.inode.size / BLOCK_SIZE) {
+        return 0;
+    }
+
+    union fs_block blk;
+    dirh_read(fs, &d, slot / BLOCK_SIZE, &blk);
+    if (blk.dx.magic == DX_MAGIC) {
+        return 0;
+    }
+    return dirblk_get(&blk, slot % BLOCK_SIZE, entry);
+}
+
+/**
+ * Reporte une entrée ajoutée dans les caches du répertoire. Le filtre de Bloom et la copie
+ * en mémoire changent avant le cache des noms, voir dcache_publish.
+ */
+static void dir_cache_insert(struct sgf_mount *fs, int dir_inum, struct fs_dirent *entry) {
+    pthread_mutex_lock(&fs->dircache_lock);
+    dirbloom_add(fs, dir_inum, entry->name);
+    struct fs_dircache *dc = dircache_get(fs, dir_inum);
+    if (dc && !dircache_add(fs, dc, entry))
+        dircache_free(fs, dc);
+    dcache_store(fs, dir_inum, entry->name, entry);
+    pthread_mutex_unlock(&fs->dircache_lock);
+}
+
+/**
+ * Ajoute une entrée dans un répertoire. Un répertoire linéaire dont l'unique
+ * bloc est plein devient un répertoire indexé.
+ *
+ * @param dir_inum Inode du répertoire
+ * @param inum Numéro d'inode de l'entrée
+ * @param type type = 1 pour fichier , type = 0 pour répertoire
+ * @param name Nom du fichier/répertoire
+ * @return Position de l'entrée, -1 en cas d'erreur
+ */
+static int dir_insert(struct sgf_mount *fs, int dir_inum, int inum, int type, const char *name) {
+    struct fs_dirh d;
+    if (!dirh_open(fs, &d, dir_inum)) {
+        return -1;
+    }
+
+    struct fs_dirent temp;
+    memset(&temp, 0, sizeof(temp));
+    temp.inum = inum;
+    temp.type = type;
+    temp.isvalid = 1;
+    strncpy(temp.name, name, NAMESIZE - 1);
+
+    int slot = -1;
+    if (!(d.inode.isvalid & INODE_INDEX)) {
+        union fs_block blk;
+        dirh_read(fs, &d, 0, &blk);
+        slot = dirblk_add(&blk, &temp);
+        if (slot != -1) {
+            dirh_write(fs, &d, 0, &blk);
+            dir_cache_insert(fs, dir_inum, &temp);
+            return slot;
+        }
+        if (!dx_convert(fs, &d)) {
+            dirh_close(fs, &d);
+            return -1;
+        }
+    }
+
+    slot = dx_insert(fs, &d, &temp);
+    dirh_close(fs, &d);
+    if (slot != -1)
+        dir_cache_insert(fs, dir_inum, &temp);
+    return slot;
+}
+
+/**
+ * Invalide l'entrée d'un répertoire à la position donnée
+ *
+ * @param dir_inum Inode du répertoire
+ * @param slot Position de l'entrée
+ */
+static void dir_erase(struct sgf_mount *fs, int dir_inum, int slot) {
+    struct fs_dirh d;
+    if (!dirh_open(fs, &d, dir_inum)) {
+        return;
+    }
+
+    union fs_block blk;
+    struct fs_dirent entry;
+    dirh_read(fs, &d, slot / BLOCK_SIZE, &blk);
+    if (!dirblk_erase(&blk, slot % BLOCK_SIZE, &entry)) {
+        return;
+    }
+    dirh_write(fs, &d, slot / BLOCK_SIZE, &blk);
+
+    pthread_mutex_lock(&fs->dircache_lock);
+    struct fs_dircache *dc = dircache_get(fs, dir_inum);
+    if (dc) {
+        int cached = dircache_find(dc, entry.name);
+        if (cached != -1)
+            dircache_remove(fs, dc, cached);
+    }
+    if (entry.type == 0) {
+        dircache_drop(fs, entry.inum);
+        dirbloom_drop(fs, entry.inum);
+        dcache_forget_dir(fs, entry.inum);
+    }
+    dcache_store(fs, dir_inum, entry.name, NULL);
+    pthread_mutex_unlock(&fs->dircache_lock);
+}
+
+/**
+ * Fait désigner un autre inode à l'entrée d'un répertoire, en une seule écriture de bloc
+ *
+ * @param dir_inum Inode du répertoire
+ * @param slot Position de l'entrée
+ * @param inum Nouvel inode
+ * @param type Nouveau type
+ */
+static void dir_retarget(struct sgf_mount *fs, int dir_inum, int slot, int inum, int type) {
+    struct fs_dirh d;
+    if (!dirh_open(fs, &d, dir_inum)) {
+        return;
+    }
+
+    union fs_block blk;
+    struct fs_dirent entry;
+    dirh_read(fs, &d, slot / BLOCK_SIZE, &blk);
+    if (!dirblk_get(&blk, slot % BLOCK_SIZE, &entry)) {
+        return;
+    }
+    DIRREC_AT(&blk, slot % BLOCK_SIZE)->inum = inum;
+    DIRREC_AT(&blk, slot % BLOCK_SIZE)->type = type;
+    dirh_write(fs, &d, slot / BLOCK_SIZE, &blk);
+
+    entry.inum = inum;
+    entry.type = type;
+    pthread_mutex_lock(&fs->dircache_lock);
+    struct fs_dircache *dc = dircache_get(fs, dir_inum);
+    if (dc) {
+        int cached = dircache_find(dc, entry.name);
+        if (cached != -1) {
+            seq_write_begin(&dc->seq);
+            WRITE_ONCE(dc->inums[cached], inum);
+            WRITE_ONCE(dc->types[cached], type);
+            seq_write_end(&dc->seq);
+        }
+    }
+    dcache_store(fs, dir_inum, entry.name, &entry);
+    pthread_mutex_unlock(&fs->dircache_lock);
+}
+
+/**
+ * Crée un inode répertoire contenant les entrées "." et ".."
+ *
+ * @param parent_inum Inode du répertoire parent
+ * @return Numéro de l'inode créé, 0 en cas d'erreur
+ */
+static int dir_create(struct sgf_mount *fs, int parent_inum) {
+    int inum = inode_alloc(fs, INODE_VALID | INODE_DIR);
+    if (inum == 0) {
+        return 0;
+    }
+
+    int ptr = get_bloc(fs);
+    if (ptr == -1) {
+        file_delete(fs, inum);
+        return 0;
+    }
+
+    union fs_block blk;
+    dirblk_init_dots(&blk, inum, parent_inum);
+    bloc_write(fs, ptr, blk.data);
+
+    struct fs_inode inode;
+    inode_load(fs, inum, &inode);
+    inode.size = BLOCK_SIZE;
+    inode.direct[0] = ptr;
+    inode_store(fs, inum, &inode);
+    return inum;
+}
+
+/**
+ * Trouve une entrée valide avec le même nom.
+ *
+ * @param dir Répertoire de recherche
+ * @param name Nom du fichier/répertoire
+ * @param entry Reçoit l'entrée trouvée, peut être NULL
+ * @return décalage dans la table. -1 en cas d'erreur
+ */
+int fs_dir_lookup(struct sgf_mount *fs, struct fs_directory dir, char name[], struct fs_dirent *entry) {
+    return dir_find(fs, dir.inum, name, entry);
+}
+
+/**
+ * Cherche un nom sans verrou dans le cache des noms, puis dans la copie en mémoire
+ * du répertoire ou son filtre de Bloom
+ *
+ * @return 1 si le nom est présent, 0 s'il est absent, -1 si les caches ne permettent pas de conclure
+ */
+static int dir_lookup_fast(struct sgf_mount *fs, int parent, const char *name, struct fs_dirent *entry) {
+    int hit = dcache_lookup(fs, parent, name, entry);
+    if (hit == -1)
+        hit = dircache_lookup(fs, parent, name, entry);
+    return hit;
+}
+
+/**
+ * Cherche un nom sous dircache_lock, en chargeant au besoin le répertoire en mémoire.
+ * L'appelant tient le verrou de l'inode du répertoire, au moins en lecture.
+ * Le résultat est enregistré sous dircache_lock : une modification du répertoire, qui
+ * met les caches à jour sous ce verrou, ne peut pas être écrasée par un résultat périmé.
+ *
+ * @return vrai si le nom est présent
+ */
+static int dir_lookup_slow(struct sgf_mount *fs, int parent, const char *name, struct fs_dirent *entry) {
+    int found;
+    pthread_mutex_lock(&fs->dircache_lock);
+    struct fs_dircache *dc = dircache_get(fs, parent);
+    // Un nom absent du filtre de Bloom n'oblige pas à charger le répertoire
+    if (dc == NULL && dirbloom_absent(fs, parent, name)) {
+        dcache_store(fs, parent, name, NULL);
+        pthread_mutex_unlock(&fs->dircache_lock);
+        return 0;
+    }
+    if (dc == NULL)
+        dc = dircache_load(fs, parent);
+    if (dc) {
+        int slot = dircache_find(dc, name);
+        found = slot != -1;
+        if (found) {
+            entry->type = dc->types[slot];
+            entry->isvalid = 1;
+            entry->inum = dc->inums[slot];
+            strcpy(entry->name, dc->names[slot]);
+        }
+    } else {
+        found = dir_find(fs, parent, name, entry) != -1;
+    }
+    dcache_store(fs, parent, name, found ? entry : NULL);
+    pthread_mutex_unlock(&fs->dircache_lock);
+    return found;
+}
+
+/**
+ * Cherche un nom dans un répertoire en passant par les caches sans verrou,
+ * puis par la copie en mémoire du répertoire chargée à la première recherche.
+ * L'appelant tient le verrou de l'inode du répertoire, au moins en lecture.
+ *
+ * @param parent Inode du répertoire
+ * @param name Nom cherché
+ * @param entry Reçoit l'entrée trouvée
+ * @return vrai si le nom est présent
+ */
+static int dir_lookup_cached(struct sgf_mount *fs, int parent, const char *name, struct fs_dirent *entry) {
+    int hit = dir_lookup_fast(fs, parent, name, entry);
+    if (hit != -1) {
+        return hit;
+    }
+    return dir_lookup_slow(fs, parent, name, entry);
+}
+
+/**
+ * Résout un chemin composant par composant, "." et ".." compris
+ *
+ * @param dir Répertoire de départ d'un chemin relatif
+ * @param path Chemin absolu ou relatif, composants séparés par '/'
+ * @param entry Reçoit l'entrée du dernier composant
+ * @return vrai si le chemin existe
+ */
+int fs_resolve(struct sgf_mount *fs, struct fs_directory dir, const char path[], struct fs_dirent *entry) {
+    memset(entry, 0, sizeof(*entry));
+    entry->isvalid = 1;
+    entry->type = 0;
+    if (path[0] == '/') {
+        entry->inum = FS_ROOT_INUM;
+    } else {
+        entry->inum = dir.inum;
+        strcpy(entry->name, dir.name);
+    }
+
+    char comp[NAMESIZE];
+    const char *p = path;
+    while (*p != '\0') {
+        while (*p == '/')
+            p++;
+        if (*p == '\0')
+            break;
+        size_t len = strcspn(p, "/");
+        // Seul un répertoire peut avoir des composants après lui
+        if (len >= NAMESIZE || entry->type != 0) {
+            return 0;
+        }
+        memcpy(comp, p, len);
+        comp[len] = '\0';
+        p += len;
+        if (streq(comp, "."))
+            continue;
+        // Les caches répondent sans verrou, le verrou du répertoire n'est pris que pour le charger
+        int parent = entry->inum;
+        int found = dir_lookup_fast(fs, parent, comp, entry);
+        if (found == -1) {
+            pthread_rwlock_rdlock(INODE_LOCK(fs, parent));
+            found = dir_lookup_slow(fs, parent, comp, entry);
+            pthread_rwlock_unlock(INODE_LOCK(fs, parent));
+        }
+        if (!found) {
+            return 0;
+        }
+    }
+
+    if (entry->inum == FS_ROOT_INUM)
+        strcpy(entry->name, "/");
+    return 1;
+}
+
+/**
+ * Sépare un chemin en répertoire parent et nom final
+ *
+ * @param s Session dont le répertoire courant sert de départ aux chemins relatifs
+ * @param path Chemin absolu ou relatif au répertoire courant
+ * @param parent Reçoit le répertoire parent
+ * @return Nom final dans path, NULL si le parent n'est pas un répertoire existant
+ */
+static char *path_split(struct sgf_session *s, char path[], struct fs_directory *parent) {
+    struct sgf_mount *fs = s->fs;
+    char *name = strrchr(path, '/');
+    if (name == NULL) {
+        *parent = s->cwd;
+        return path;
+    }
+
+    size_t len = name - path;
+    char dirpath[len + 2];
+    memcpy(dirpath, path, len);
+    dirpath[len] = '\0';
+    if (len == 0)
+        strcpy(dirpath, "/");
+
+    struct fs_dirent entry;
+    if (!fs_resolve(fs, s->cwd, dirpath, &entry) || entry.type != 0) {
+        return NULL;
+    }
+    parent->isvalid = 1;
+    parent->inum = entry.inum;
+    strcpy(parent->name, entry.name);
+    return name + 1;
+}
+
+/**
+ * Vérifie si un répertoire est un autre répertoire ou l'un de ses ancêtres
+ *
+ * @param ancestor Inode de l'ancêtre supposé
+ * @param inum Inode du répertoire
+ * @return vrai si inum est dans l'arborescence de ancestor
+ */
+static int dir_contains(struct sgf_mount *fs, int ancestor, int inum) {
+    struct fs_dirent entry;
+    int cur = inum;
+    while (cur != ancestor) {
+        if (cur == FS_ROOT_INUM || !dir_lookup_cached(fs, cur, "..", &entry)) {
+            return 0;
+        }
+        cur = entry.inum;
+    }
+    return 1;
+}
+
+/**
+ * Cherche une session dont le répertoire courant est dans le sous-arbre d'un répertoire
+ *
+ * @param inum Inode du répertoire
+ * @return vrai si une session l'utilise
+ */
+static int dir_in_use(struct sgf_mount *fs, int inum) {
+    int used = 0;
+    pthread_mutex_lock(&fs->session_lock);
+    for (struct sgf_session *s = fs->sessions; s != NULL && !used; s = s->next)
+        used = dir_contains(fs, inum, s->cwd.inum);
+    pthread_mutex_unlock(&fs->session_lock);
+    return used;
+}
+
+/**
+ * Ajoute une entrée à un répertoire
+ *
+ * @param dir Répertoire dans lequel l'entrée doit être ajoutée
+ * @param inum Numéro d'inode
+ * @param type type = 1 pour fichier , type = 0 pour répertoire
+ * @param name Nom du fichier/répertoire
+ * @return Répertoire avec une entrée ajoutée ou avec un bit valide mis à 0 en cas d'erreur.
+ */
+struct fs_directory fs_add_dir_entry(struct sgf_mount *fs, struct fs_directory dir, int inum, int type, char name[]) {
+    batch_begin(fs);
+    if (dir_insert(fs, dir.inum, inum, type, name) == -1) {
+        dir.isvalid = 0;
+    }
+    batch_commit(fs);
+    return dir;
+}
+
+/**
+ * Lit le répertoire à partir du décalage du Dirent
+ *
+ * @param offset Décalage de la table qui doit être lue.
+ * @return Retourne le répertoire avec bit valide, un bit=0 en cas d'erreur.
+ */
+struct fs_directory fs_read_dir_from_offset(struct sgf_session *s, int offset) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    struct fs_directory temp;
+    struct fs_dirent entry;
+    memset(&temp, 0, sizeof(temp));
+
+    if (fs == NULL) {
+        temp.isvalid = 0;
+        return temp;
+    }
+    pthread_rwlock_rdlock(INODE_LOCK(fs, s->cwd.inum));
+    int found = dir_entry_at(fs, s->cwd.inum, offset, &entry);
+    pthread_rwlock_unlock(INODE_LOCK(fs, s->cwd.inum));
+    if (!found || entry.type != 0) {
+        temp.isvalid = 0;
+        return temp;
+    }
+
+    temp.isvalid = 1;
+    temp.inum = entry.inum;
+    if (entry.inum == FS_ROOT_INUM)
+        strcpy(temp.name, "/");
+    else
+        strcpy(temp.name, entry.name);
+    return temp;
+}
+
+/**
+ * Lister toutes les entrées du répertoire courant de la session.
+ *
+ * @return vrai en cas de succès, faux en cas d'échec
+ */
+int fs_ls(struct sgf_session *s) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
+        printf("Disque non monté\n");
         return -1;
     }
     char name[] = ".";
-    return fs_dir(name);
+    return fs_dir(s, name);
 }
 
 /**
  * Liste le répertoire donné par le nom. Appelé par ls pour imprimer current_dir. Imprime un tableau des répertoires.
- * @param name Nom du répertoire
+ * @param name Chemin du répertoire
  * @return vrai en cas de succès, erreur en cas d'échec
  */
-int fs_dir(char name[]) {
-    if (bitmap == NULL) {
+int fs_dir(struct sgf_session *s, char name[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
         printf("Disque non monté\n");
         return -1;
     }
-    int offset = fs_dir_lookup(curr_dir, name);
-    if (offset == -1) {
+    struct fs_dirent dir;
+    if (!fs_resolve(fs, s->cwd, name, &dir)) {
         return -1;
     }
-
-    struct fs_directory dir = fs_read_dir_from_offset(offset);
-
-    if (dir.isvalid == 0) {
+    if (dir.type != 0) {
         printf("Répertoire incorrecte\n");
         return -1;
     }
 
+    struct fs_inode inode;
+    pthread_rwlock_rdlock(INODE_LOCK(fs, dir.inum));
+    inode_load(fs, dir.inum, &inode);
+    struct fs_map map;
+    map_init(&map, &inode);
+    union fs_block blk;
+
     printf("  inodeNum |       Nom        | Propriété\n");
-    for (int idx = 0; idx < ENTRIES_PER_DIR; idx++) {
-        struct fs_dirent temp = dir.table[idx];
-        if (temp.isvalid == 1) {
-            if (temp.type == 1)
-                printf("%-10u | %-16s | %-5s\n", temp.inum, temp.name, "file");
-            else
-                printf("%-10u | %-16s | %-5s\n", temp.inum, temp.name, "dir");
+    for (int index = 0; index < inode.size / BLOCK_SIZE; index++) {
+        bloc_read(fs, map_get(fs, &map, index), blk.data);
+        if (blk.dx.magic == DX_MAGIC)
+            continue;
+        for (int off = 0; off < BLOCK_SIZE; off = dirblk_next(&blk, off)) {
+            struct fs_dirent temp;
+            if (DIRREC_AT(&blk, off)->inum != 0) {
+                dirrec_decode(DIRREC_AT(&blk, off), &temp);
+                if (temp.type == 1)
+                    printf("%-10u | %-16s | %-5s\n", temp.inum, temp.name, "file");
+                else
+                    printf("%-10u | %-16s | %-5s\n", temp.inum, temp.name, "dir");
+            }
+        }
+    }
+    pthread_rwlock_unlock(INODE_LOCK(fs, dir.inum));
+    return 1;
+}
+
+/**
+ * Lit les entrées d'un répertoire par lots. Le curseur est opaque : il vaut 0 pour
+ * commencer et chaque appel le place après la dernière entrée rendue.
+ *
+ * @param dir Répertoire à lire
+ * @param cursor Position de reprise, mise à jour
+ * @param entries Reçoit les entrées
+ * @param max Nombre maximal d'entrées rendues
+ * @return Nombre d'entrées rendues, 0 à la fin du répertoire, -1 en cas d'erreur
+ */
+int fs_readdir(struct sgf_mount *fs, struct fs_directory dir, int *cursor, struct fs_dirent entries[], int max) {
+    struct fs_dirh d;
+    if (fs == NULL || *cursor < 0) {
+        return -1;
+    }
+    pthread_rwlock_rdlock(INODE_LOCK(fs, dir.inum));
+    if (!dirh_open(fs, &d, dir.inum)) {
+        pthread_rwlock_unlock(INODE_LOCK(fs, dir.inum));
+        return -1;
+    }
+
+    union fs_block blk;
+    int n = 0;
+    int nblocks = d.inode.size / BLOCK_SIZE;
+    for (int index = *cursor / BLOCK_SIZE; index < nblocks && n < max; index++) {
+        int start = index == *cursor / BLOCK_SIZE ? *cursor % BLOCK_SIZE : 0;
+        dirh_read(fs, &d, index, &blk);
+        if (blk.dx.magic == DX_MAGIC) {
+            *cursor = (index + 1) * BLOCK_SIZE;
+            continue;
+        }
+
+        // Un enregistrement effacé depuis l'appel précédent a pu rejoindre son prédécesseur :
+        // reprendre au premier enregistrement qui commence après le curseur
+        int off;
+        for (off = 0; off < BLOCK_SIZE && n < max; off = dirblk_next(&blk, off)) {
+            if (off < start || DIRREC_AT(&blk, off)->inum == 0)
+                continue;
+            dirrec_decode(DIRREC_AT(&blk, off), &entries[n++]);
+        }
+        *cursor = off < BLOCK_SIZE ? index * BLOCK_SIZE + off : (index + 1) * BLOCK_SIZE;
+    }
+    pthread_rwlock_unlock(INODE_LOCK(fs, dir.inum));
+    return n;
+}
+
+// Inode d'une demande de fs_stat_many, pour les trier par bloc de la table des inodes
+struct stat_order {
+    int inum;
+    int index;
+};
+
+static int compare_stat_order(const void *a, const void *b) {
+    return ((const struct stat_order *) a)->inum - ((const struct stat_order *) b)->inum;
+}
+
+/**
+ * Lit les attributs de plusieurs inodes. Les demandes sont triées par bloc
+ * de la table des inodes, chaque bloc n'est lu qu'une fois.
+ *
+ * @param inums Numéros des inodes
+ * @param stats Reçoit les attributs dans l'ordre des demandes, isvalid = 0 pour un inode invalide
+ * @param n Nombre d'inodes
+ * @return Nombre d'inodes valides, -1 en cas d'erreur
+ */
+int fs_stat_many(struct sgf_mount *fs, const int inums[], struct fs_stat stats[], int n) {
+    if (fs == NULL) {
+        return -1;
+    }
+    struct stat_order *order = malloc(n * sizeof(struct stat_order));
+    if (order == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        order[i].inum = inums[i];
+        order[i].index = i;
+    }
+    qsort(order, n, sizeof(struct stat_order), compare_stat_order);
+
+    union fs_block block;
+    int loaded = -1, nvalid = 0;
+    for (int i = 0; i < n; i++) {
+        int inum = order[i].inum;
+        struct fs_stat *st = &stats[order[i].index];
+        memset(st, 0, sizeof(*st));
+        st->inum = inum;
+        if (inum <= 0 || inum >= fs->sb.super.ninodes) {
+            continue;
+        }
+        if (INODE_BLOC(inum) != loaded) {
+            loaded = INODE_BLOC(inum);
+            meta_read(fs, loaded, block.data);
+        }
+        struct fs_inode *inode = &block.inode[INODE_OFFSET(inum)];
+        st->isvalid = inode->isvalid;
+        st->size = inode->size;
+        if (inode->isvalid)
+            nvalid++;
+    }
+    free(order);
+    return nvalid;
+}
+
+/**
+ * Liste le répertoire courant avec la taille de chaque entrée, par lots de FS_READDIR_BATCH entrées
+ *
+ * @return vrai en cas de succès, faux en cas d'échec
+ */
+int fs_ls_long(struct sgf_session *s) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
+        printf("Disque non monté\n");
+        return 0;
+    }
+
+    struct fs_dirent entries[FS_READDIR_BATCH];
+    struct fs_stat stats[FS_READDIR_BATCH];
+    int inums[FS_READDIR_BATCH];
+    int cursor = 0, n;
+
+    printf("  inodeNum |       Nom        | Propriété |   Taille\n");
+    while ((n = fs_readdir(fs, s->cwd, &cursor, entries, FS_READDIR_BATCH)) > 0) {
+        for (int i = 0; i < n; i++)
+            inums[i] = entries[i].inum;
+        fs_stat_many(fs, inums, stats, n);
+        for (int i = 0; i < n; i++) {
+            printf("%-10u | %-16s | %-9s | %8d\n", entries[i].inum, entries[i].name,
+                   entries[i].type == 1 ? "file" : "dir", stats[i].size);
+        }
+    }
+    return n == 0;
+}
+
+// Répertoire à parcourir par fs_walk
+struct walk_item {
+    int inum;
+    int depth;
+    char *path;
+};
+
+// File d'un thread du parcours : il prend en queue, les autres volent en tête
+struct walk_deque {
+    pthread_mutex_t lock;
+    struct walk_item *items;
+    int head;
+    int tail;
+    int capacity;
+};
+
+struct walk_pool {
+    struct sgf_mount *fs;
+    struct walk_deque deques[FS_WALK_THREADS];
+    int nthreads;
+    int pending;              // Répertoires en file ou en cours de lecture
+    int errors;
+    int visited;
+    pthread_mutex_t visit_lock;
+    fs_walk_fn visit;
+    void *arg;
+};
+
+struct walk_worker {
+    struct walk_pool *pool;
+    int id;
+};
+
+static int walk_push(struct walk_deque *dq, struct walk_item *item) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->capacity) {
+        int capacity = dq->capacity ? dq->capacity * 2 : 64;
+        struct walk_item *items = realloc(dq->items, capacity * sizeof(struct walk_item));
+        if (items == NULL) {
+            pthread_mutex_unlock(&dq->lock);
+            return 0;
+        }
+        dq->items = items;
+        dq->capacity = capacity;
+    }
+    dq->items[dq->tail++] = *item;
+    pthread_mutex_unlock(&dq->lock);
+    return 1;
+}
+
+/**
+ * Retire un répertoire d'une file
+ *
+ * @param own vrai pour le thread propriétaire (queue de la file), faux pour un vol (tête)
+ * @return vrai si un répertoire a été retiré
+ */
+static int walk_pop(struct walk_deque *dq, struct walk_item *item, int own) {
+    pthread_mutex_lock(&dq->lock);
+    int found = dq->head < dq->tail;
+    if (found) {
+        *item = own ? dq->items[--dq->tail] : dq->items[dq->head++];
+        if (dq->head == dq->tail)
+            dq->head = dq->tail = 0;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/**
+ * Lit un répertoire par lots de FS_READDIR_BATCH entrées, lit les inodes de chaque lot
+ * avec fs_stat_many et met les sous-répertoires dans la file du thread
+ */
+static void walk_dir(struct walk_pool *pool, int id, struct walk_item *item) {
+    struct sgf_mount *fs = pool->fs;
+    struct fs_dirent entries[FS_READDIR_BATCH];
+    struct fs_stat stats[FS_READDIR_BATCH];
+    int inums[FS_READDIR_BATCH];
+    struct fs_walkent ent;
+    struct fs_directory dir = {1, item->inum, ""};
+    int cursor = 0, n;
+
+    while ((n = fs_readdir(fs, dir, &cursor, entries, FS_READDIR_BATCH)) > 0) {
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            if (!streq(entries[i].name, ".") && !streq(entries[i].name, ".."))
+                entries[m++] = entries[i];
+        }
+        for (int i = 0; i < m; i++)
+            inums[i] = entries[i].inum;
+        fs_stat_many(fs, inums, stats, m);
+
+        pthread_mutex_lock(&pool->visit_lock);
+        for (int i = 0; i < m; i++) {
+            ent.inum = entries[i].inum;
+            ent.type = entries[i].type;
+            ent.size = stats[i].size;
+            ent.depth = item->depth + 1;
+            snprintf(ent.path, FS_PATHSIZE, "%s%s%s", item->path, *item->path ? "/" : "", entries[i].name);
+            pool->visit(&ent, pool->arg);
+            pool->visited++;
+
+            if (ent.type == 0) {
+                struct walk_item child = {ent.inum, ent.depth, strdup(ent.path)};
+                __atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+                if (child.path == NULL || !walk_push(&pool->deques[id], &child)) {
+                    free(child.path);
+                    pool->errors++;
+                    __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+                }
+            }
+        }
+        pthread_mutex_unlock(&pool->visit_lock);
+    }
+    if (n < 0) {
+        pthread_mutex_lock(&pool->visit_lock);
+        pool->errors++;
+        pthread_mutex_unlock(&pool->visit_lock);
+    }
+}
+
+static void *walk_worker(void *arg) {
+    struct walk_worker *w = arg;
+    struct walk_pool *pool = w->pool;
+    struct walk_item item;
+
+    while (1) {
+        int found = walk_pop(&pool->deques[w->id], &item, 1);
+        for (int i = 1; !found && i < pool->nthreads; i++)
+            found = walk_pop(&pool->deques[(w->id + i) % pool->nthreads], &item, 0);
+
+        if (found) {
+            walk_dir(pool, w->id, &item);
+            free(item.path);
+            __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+        } else if (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) == 0) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Parcourt un sous-arbre avec un thread par coeur, au plus FS_WALK_THREADS. Chaque répertoire
+ * est une tâche, un thread sans tâche en vole une dans la file d'un autre. L'ordre des visites
+ * n'est pas défini, mais visit n'est jamais appelée par deux threads à la fois.
+ *
+ * @param dir Répertoire de départ, il n'est pas visité lui-même
+ * @param visit Fonction appelée pour chaque entrée du sous-arbre
+ * @param arg Argument passé à visit
+ * @return Nombre d'entrées visitées, -1 en cas d'erreur
+ */
+int fs_walk(struct sgf_mount *fs, struct fs_directory dir, fs_walk_fn visit, void *arg) {
+    if (fs == NULL) {
+        return -1;
+    }
+
+    struct walk_pool pool;
+    memset(&pool, 0, sizeof(pool));
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    pool.nthreads = ncpu < 1 ? 1 : ncpu > FS_WALK_THREADS ? FS_WALK_THREADS : (int) ncpu;
+    pool.fs = fs;
+    pool.visit = visit;
+    pool.arg = arg;
+    pthread_mutex_init(&pool.visit_lock, NULL);
+    for (int i = 0; i < pool.nthreads; i++)
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+
+    struct walk_item root = {dir.inum, 0, strdup("")};
+    pool.pending = 1;
+    if (root.path == NULL || !walk_push(&pool.deques[0], &root)) {
+        free(root.path);
+        pool.pending = 0;
+        pool.errors++;
+    }
+
+    // Le thread appelant est le travailleur 0
+    struct walk_worker workers[FS_WALK_THREADS];
+    pthread_t threads[FS_WALK_THREADS];
+    int started = 1;
+    for (int i = 0; i < pool.nthreads; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+    while (started < pool.nthreads && thread_start(&threads[started], walk_worker, &workers[started]) == 0)
+        started++;
+    walk_worker(&workers[0]);
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < pool.nthreads; i++) {
+        free(pool.deques[i].items);
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    pthread_mutex_destroy(&pool.visit_lock);
+    return pool.errors ? -1 : pool.visited;
+}
+
+/**
+ * Trouve le répertoire de départ d'une commande de parcours
+ *
+ * @param path Chemin du répertoire, NULL ou vide pour le répertoire courant
+ * @param dir Reçoit le répertoire
+ * @return vrai si le chemin désigne un répertoire
+ */
+static int walk_start(struct sgf_session *s, char path[], struct fs_directory *dir) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    struct fs_dirent entry;
+    if (fs == NULL) {
+        printf("Disque non monté\n");
+        return 0;
+    }
+    if (path == NULL || *path == '\0') {
+        *dir = s->cwd;
+        return 1;
+    }
+    if (!fs_resolve(fs, s->cwd, path, &entry) || entry.type != 0) {
+        printf("Répertoire introuvable\n");
+        return 0;
+    }
+    dir->isvalid = 1;
+    dir->inum = entry.inum;
+    strcpy(dir->name, entry.name);
+    return 1;
+}
+
+struct du_totals {
+    long long bytes;
+    int files;
+    int dirs;
+};
+
+static void du_visit(const struct fs_walkent *entry, void *arg) {
+    struct du_totals *t = arg;
+    t->bytes += entry->size;
+    if (entry->type == 0)
+        t->dirs++;
+    else
+        t->files++;
+}
+
+/**
+ * Affiche l'espace occupé par un sous-arbre
+ *
+ * @param path Chemin du répertoire, NULL ou vide pour le répertoire courant
+ * @return vrai en cas de succès
+ */
+int fs_du(struct sgf_session *s, char path[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    struct fs_directory dir;
+    struct du_totals t = {0};
+    if (!walk_start(s, path, &dir) || fs_walk(fs, dir, du_visit, &t) < 0) {
+        return 0;
+    }
+    printf("%lld octets, %d fichiers, %d répertoires\n", t.bytes, t.files, t.dirs);
+    return 1;
+}
+
+static void find_visit(const struct fs_walkent *entry, void *arg) {
+    const char *name = strrchr(entry->path, '/');
+    name = name ? name + 1 : entry->path;
+    if (fnmatch(arg, name, 0) == 0)
+        printf("%s\n", entry->path);
+}
+
+/**
+ * Affiche les entrées d'un sous-arbre dont le nom correspond à un motif
+ *
+ * @param path Chemin du répertoire, NULL ou vide pour le répertoire courant
+ * @param pattern Motif du nom, avec les jokers * ? [...]
+ * @return vrai en cas de succès
+ */
+int fs_find(struct sgf_session *s, char path[], char pattern[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    struct fs_directory dir;
+    if (!walk_start(s, path, &dir)) {
+        return 0;
+    }
+    return fs_walk(fs, dir, find_visit, pattern) >= 0;
+}
+
+struct tree_list {
+    struct fs_walkent *entries;
+    int count;
+    int capacity;
+};
+
+static void tree_visit(const struct fs_walkent *entry, void *arg) {
+    struct tree_list *list = arg;
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        struct fs_walkent *entries = realloc(list->entries, capacity * sizeof(struct fs_walkent));
+        if (entries == NULL)
+            return;
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+    list->entries[list->count++] = *entry;
+}
+
+// Ordre des chemins où chaque répertoire est suivi de son contenu : '/' passe avant tout caractère
+static int compare_tree_path(const void *a, const void *b) {
+    const unsigned char *p = (const unsigned char *) ((const struct fs_walkent *) a)->path;
+    const unsigned char *q = (const unsigned char *) ((const struct fs_walkent *) b)->path;
+    while (*p && *p == *q) {
+        p++;
+        q++;
+    }
+    int c = *p == '/' ? 1 : *p;
+    int d = *q == '/' ? 1 : *q;
+    return c - d;
+}
+
+/**
+ * Affiche l'arborescence d'un répertoire
+ *
+ * @param path Chemin du répertoire, NULL ou vide pour le répertoire courant
+ * @return vrai en cas de succès
+ */
+int fs_tree(struct sgf_session *s, char path[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    struct fs_directory dir;
+    struct tree_list list = {0};
+    if (!walk_start(s, path, &dir) || fs_walk(fs, dir, tree_visit, &list) < 0) {
+        free(list.entries);
+        return 0;
+    }
+
+    qsort(list.entries, list.count, sizeof(struct fs_walkent), compare_tree_path);
+    printf("%s\n", path && *path ? path : ".");
+    for (int i = 0; i < list.count; i++) {
+        const char *name = strrchr(list.entries[i].path, '/');
+        printf("%*s%s%s\n", 4 * (list.entries[i].depth - 1), "", name ? name + 1 : list.entries[i].path,
+               list.entries[i].type == 0 ? "/" : "");
+    }
+    free(list.entries);
+    return 1;
+}
+
+/**
+ * Prend en écriture le verrou d'un répertoire et vérifie qu'il existe toujours :
+ * il a pu être supprimé depuis la résolution de son chemin
+ *
+ * @param inum Inode du répertoire
+ * @return vrai si le verrou est pris
+ */
+static int dir_wrlock(struct sgf_mount *fs, int inum) {
+    struct fs_inode inode;
+    pthread_rwlock_wrlock(INODE_LOCK(fs, inum));
+    if (inode_load(fs, inum, &inode) && (inode.isvalid & INODE_DIR)) {
+        return 1;
+    }
+    pthread_rwlock_unlock(INODE_LOCK(fs, inum));
+    return 0;
+}
+
+/**
+ * Cherche une entrée et prend en écriture les verrous du répertoire et de l'inode trouvé.
+ * L'entrée est cherchée à nouveau sous les verrous tant qu'elle change avant leur prise.
+ *
+ * @param dir_inum Inode du répertoire
+ * @param name Nom cherché
+ * @param entry Reçoit l'entrée
+ * @param held Reçoit les indices des verrous pris, 2 places
+ * @param nheld Reçoit le nombre de verrous pris
+ * @return Position de l'entrée, -1 si elle est absente et aucun verrou n'est gardé
+ */
+static int dir_lock_entry(struct sgf_mount *fs, int dir_inum, const char *name, struct fs_dirent *entry, int held[], int *nheld) {
+    int inums[2] = {dir_inum, 0};
+    *nheld = inode_lock_many(fs, inums, 1, held);
+    for (;;) {
+        int offset = dir_find(fs, dir_inum, name, entry);
+        if (offset == -1) {
+            inode_unlock_many(fs, held, *nheld);
+            return -1;
+        }
+        if (entry->inum == inums[1]) {
+            return offset;
         }
+        inode_unlock_many(fs, held, *nheld);
+        inums[1] = entry->inum;
+        *nheld = inode_lock_many(fs, inums, 2, held);
     }
-    return 1;
 }
 
 /**
  * Crée un répertoire vide avec le nom donné.
  *
- * @param name Nom du répertoire
+ * @param name Chemin du répertoire
  * @return
  */
-int fs_mkdir(char name[NAMESIZE]) {
-    if (bitmap == NULL) {
-        printf("Veuillez monter le disque\n");
-        return -1;
-    }
-
-    union fs_block zero;
-    disque_read(0, zero.data);
-
-    // trouver dirBlock vide
-    int bloc_index = 0;
-    for (; bloc_index < zero.super.nblocks; bloc_index++)
-        if (dir_counter[bloc_index] < DIR_PER_BLOCK)
-            break;
-
-    if (bloc_index == zero.super.ndirblocks) {
-        printf("Répertoire plein!\n");
-        return -1;
+static int mkdir_path(struct sgf_mount *fs, struct sgf_session *s, char name[]) {
+    struct fs_directory parent;
+    struct fs_dirent entry;
+    char *leaf = path_split(s, name, &parent);
+    if (leaf == NULL || *leaf == '\0') {
+        printf("Chemin introuvable\n");
+        return 0;
     }
-
-    union fs_block block;
-    disque_read(zero.super.nblocks - 1 - bloc_index, block.data);
-
-    // Trouve un repertoire vide dans dirBlok
-    int offset = 0;
-    for (; offset < DIR_PER_BLOCK; offset++)
-        if (block.directories[offset].isvalid == 0)
-            break;
-
-    if (offset == DIR_PER_BLOCK) {
-        return -1;
+    if (strlen(leaf) >= NAMESIZE) {
+        printf("Nom trop long\n");
+        return 0;
     }
-
-    // crée un nouveau repertoire
-    struct fs_directory new_dir, temp;
-    memset(&new_dir, 0, sizeof(struct fs_directory));
-    new_dir.inum = bloc_index * DIR_PER_BLOCK + offset;
-    new_dir.isvalid = 1;
-    strcpy(new_dir.name, name);
-
-    // Créer deux entrées "." et ".."
-    char tstr1[] = ".", tstr2[] = "..";
-    temp = new_dir;
-    temp = fs_add_dir_entry(temp, temp.inum, 0, tstr1);
-    temp = fs_add_dir_entry(temp, curr_dir.inum, 0, tstr2);
-    if (temp.isvalid == 0) {
+    if (!dir_wrlock(fs, parent.inum)) {
+        printf("Chemin introuvable\n");
         return 0;
     }
-    new_dir = temp;
-
-    temp = fs_add_dir_entry(curr_dir, new_dir.inum, 0, new_dir.name);
-    if (temp.isvalid == 0) {
+    if (dir_lookup_cached(fs, parent.inum, leaf, &entry)) {
+        printf("Ce nom de fichier existe déjà\n");
+        pthread_rwlock_unlock(INODE_LOCK(fs, parent.inum));
         return 0;
     }
-    curr_dir = temp;
 
-    // Réécrire le nouveau répertoire sur le disque
-    fs_write_dir_back(new_dir);
-
-    // Réécrire le répertoire courant sur le disque.
-    fs_write_dir_back(curr_dir);
-
-    // Incrémenter le compteur
-    dir_counter[bloc_index]++;
+    // crée un nouveau repertoire avec ses entrées "." et ".."
+    int ret = 0;
+    int inum = dir_create(fs, parent.inum);
+    if (inum != 0) {
+        struct fs_directory temp = fs_add_dir_entry(fs, parent, inum, 0, leaf);
+        if (temp.isvalid == 0)
+            file_delete(fs, inum);
+        else
+            ret = 1;
+    }
+    pthread_rwlock_unlock(INODE_LOCK(fs, parent.inum));
+    return ret;
+}
 
-    return 1;
+// Crée un répertoire dans une transaction du journal
+int fs_mkdir(struct sgf_session *s, char name[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
+        printf("Veuillez monter le disque\n");
+        return -1;
+    }
+    batch_begin(fs);
+    int ret = mkdir_path(fs, s, name);
+    batch_commit(fs);
+    return ret;
 }
 
 /**
  * Change le répertoire actuel pour le nom de répertoire donné.
- * @param name Nom du répertoire
+ * @param name Chemin du répertoire
  * @return true si cd effectué
  */
-int fs_cd(char name[NAMESIZE]) {
-    if (bitmap == NULL) {
+int fs_cd(struct sgf_session *s, char name[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
         return -1;
     }
-    // Lire le dirblock sur le disque
-    int offset = fs_dir_lookup(curr_dir, name);
-    if ((offset == -1) || (curr_dir.table[offset].type == 1)) {
+    struct fs_dirent entry;
+    if (!fs_resolve(fs, s->cwd, name, &entry) || entry.type != 0) {
         return -1;
     }
-
-    struct fs_directory temp = fs_read_dir_from_offset(offset);
-    if (temp.isvalid == 0) {
-        return -1;
-    }
-    curr_dir = temp;
+    // Les autres sessions lisent les répertoires courants sous session_lock
+    pthread_mutex_lock(&fs->session_lock);
+    s->cwd.isvalid = 1;
+    s->cwd.inum = entry.inum;
+    strcpy(s->cwd.name, entry.name);
+    pthread_mutex_unlock(&fs->session_lock);
     return 1;
 }
 
 /**
  * Crée un fichier de taille 0
  *
- * @param name Nom du fichier
+ * @param name Chemin du fichier
  * @return vrai en cas de succès, erreur en cas d'échec
  */
-int fs_touch(char name[NAMESIZE]) {
-    if (bitmap == NULL) {
+static int touch_path(struct sgf_mount *fs, struct sgf_session *s, char name[]) {
+    struct fs_directory parent;
+    struct fs_dirent entry;
+    char *leaf = path_split(s, name, &parent);
+    if (leaf == NULL || *leaf == '\0') {
+        printf("Chemin introuvable\n");
+        return 0;
+    }
+    if (strlen(leaf) >= NAMESIZE) {
+        printf("Nom trop long\n");
+        return 0;
+    }
+
+    if (!dir_wrlock(fs, parent.inum)) {
+        printf("Chemin introuvable\n");
+        return 0;
+    }
+    if (dir_lookup_cached(fs, parent.inum, leaf, &entry)) {
+        printf("Ce nom de fichier existe déjà\n");
+        pthread_rwlock_unlock(INODE_LOCK(fs, parent.inum));
+        return -1;
+    }
+    int ret = 1;
+    int new_node_idx = fs_create(fs);
+    if (new_node_idx == 0) {
+        ret = 0;
+    } else if (fs_add_dir_entry(fs, parent, new_node_idx, 1, leaf).isvalid == 0) {
+        file_delete(fs, new_node_idx);
+        ret = -1;
+    }
+    pthread_rwlock_unlock(INODE_LOCK(fs, parent.inum));
+    return ret;
+}
+
+// Crée un fichier vide dans une transaction du journal
+int fs_touch(struct sgf_session *s, char name[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
         return -1;
     }
+    batch_begin(fs);
+    int ret = touch_path(fs, s, name);
+    batch_commit(fs);
+    return ret;
+}
 
-    for (int offset = 0; offset < ENTRIES_PER_DIR; offset++) {
-        if (curr_dir.table[offset].isvalid) {
-            if (streq(curr_dir.table[offset].name, name)) {
-                printf("Ce nom de fichier existe déjà\n");
-                return -1;
-            }
-        }
+/**
+ * Crée plusieurs fichiers dans un répertoire en un seul lot d'écritures : chaque bloc
+ * d'inodes et chaque bloc du répertoire modifié n'est écrit qu'une fois.
+ *
+ * @param dir Répertoire de création
+ * @param names Noms des fichiers
+ * @param n Nombre de noms
+ * @return Nombre de fichiers créés, -1 si le disque n'est pas monté
+ */
+int fs_create_many(struct sgf_mount *fs, struct fs_directory dir, char *names[], int n) {
+    if (fs == NULL) {
+        return -1;
     }
-    int new_node_idx = fs_create();
-    if (new_node_idx == -1) {
+
+    batch_begin(fs);
+    if (!dir_wrlock(fs, dir.inum)) {
+        printf("Répertoire introuvable\n");
+        batch_commit(fs);
         return 0;
     }
 
-    struct fs_directory temp = fs_add_dir_entry(curr_dir, new_node_idx, 1, name);
-    if (temp.isvalid == 0) {
-        return -1;
+    struct fs_dirent entry;
+    int created = 0;
+    for (int i = 0; i < n; i++) {
+        if (names[i][0] == '\0' || strchr(names[i], '/') || strlen(names[i]) >= NAMESIZE) {
+            printf("Nom invalide: %s\n", names[i]);
+            continue;
+        }
+        if (dir_lookup_cached(fs, dir.inum, names[i], &entry)) {
+            printf("Ce nom de fichier existe déjà: %s\n", names[i]);
+            continue;
+        }
+        int inum = inode_alloc(fs, INODE_VALID);
+        if (inum == 0) {
+            printf("Plus d'inode libre\n");
+            break;
+        }
+        if (dir_insert(fs, dir.inum, inum, 1, names[i]) == -1) {
+            file_delete(fs, inum);
+            break;
+        }
+        created++;
     }
-    curr_dir = temp;
+    pthread_rwlock_unlock(INODE_LOCK(fs, dir.inum));
+    batch_commit(fs);
+    return created;
+}
 
-    fs_write_dir_back(curr_dir);
+/**
+ * Supprime un inode et, si c'est un répertoire, tout son sous-arbre, déjà détaché de son parent.
+ * Chaque répertoire est lu puis libéré sous son propre verrou, une opération qui l'attendait
+ * le trouve ensuite supprimé. Les fichiers sont libérés à la fin par numéro croissant et
+ * leurs blocs en une seule passe. Les entrées des répertoires supprimés ne sont pas
+ * effacées une à une : leurs blocs sont libérés avec eux.
+ *
+ * @param entry Entrée supprimée
+ * @return vrai en cas de succès
+ */
+static int tree_delete(struct sgf_mount *fs, struct fs_dirent *entry) {
+    struct fs_freelist stack = {0};
+    struct fs_freelist files = {0};
+    struct fs_freelist fl = {0};
+    if (entry->type == 0)
+        freelist_add(&stack, entry->inum);
+    else
+        freelist_add(&files, entry->inum);
+
+    int ok = 1;
+    union fs_block blk;
+    batch_begin(fs);
+    while (stack.count > 0) {
+        int dir_inum = stack.blocs[--stack.count];
+        pthread_rwlock_wrlock(INODE_LOCK(fs, dir_inum));
 
-    return 1;
+        struct fs_inode inode;
+        if (!inode_load(fs, dir_inum, &inode)) {
+            pthread_rwlock_unlock(INODE_LOCK(fs, dir_inum));
+            ok = 0;
+            continue;
+        }
+        struct fs_map map;
+        map_init(&map, &inode);
+        for (int index = 0; index < inode.size / BLOCK_SIZE; index++) {
+            int ptr = map_get(fs, &map, index);
+            if (ptr <= 0)
+                continue;
+            bloc_read(fs, ptr, blk.data);
+            if (blk.dx.magic == DX_MAGIC)
+                continue;
+            for (int off = 0; off < BLOCK_SIZE; off = dirblk_next(&blk, off)) {
+                struct fs_dirent child;
+                if (DIRREC_AT(&blk, off)->inum == 0)
+                    continue;
+                dirrec_decode(DIRREC_AT(&blk, off), &child);
+                if (streq(child.name, ".") || streq(child.name, ".."))
+                    continue;
+                freelist_add(child.type == 0 ? &stack : &files, child.inum);
+            }
+        }
+        if (!inode_release(fs, dir_inum, &fl))
+            ok = 0;
+
+        // Les caches sont vidés après la libération : un chargement ne peut plus les remplir
+        pthread_mutex_lock(&fs->dircache_lock);
+        dircache_drop(fs, dir_inum);
+        dirbloom_drop(fs, dir_inum);
+        dcache_forget_dir(fs, dir_inum);
+        pthread_mutex_unlock(&fs->dircache_lock);
+        pthread_rwlock_unlock(INODE_LOCK(fs, dir_inum));
+    }
+    free(stack.blocs);
+
+    if (files.count > 0)
+        qsort(files.blocs, files.count, sizeof(int), compare_int);
+    for (int i = 0; i < files.count; i++) {
+        pthread_rwlock_wrlock(INODE_LOCK(fs, files.blocs[i]));
+        if (!inode_release(fs, files.blocs[i], &fl))
+            ok = 0;
+        pthread_rwlock_unlock(INODE_LOCK(fs, files.blocs[i]));
+    }
+    freelist_commit(fs, &fl);
+    batch_commit(fs);
+    free(files.blocs);
+    return ok;
 }
 
 /**
@@ -707,68 +5296,61 @@ int fs_touch(char name[NAMESIZE]) {
  * @param name Nom du répertoire à supprimer
  * @return
  */
-struct fs_directory rmdir_child(struct fs_directory parent, char name[]) {
-    struct fs_directory dir, temp;
-    int inum, blk_idx, blk_off;
-    union fs_block blk, zero;
-    disque_read(0, zero.data);
-
-    if (bitmap == NULL) {
-        return dir;
-    }
-
-    // Obtenir offset du répertoire à supprimer
-    int offset = fs_dir_lookup(parent, name);
+static struct fs_directory rmdir_entry(struct sgf_mount *fs, struct fs_directory parent, char name[]) {
+    struct fs_directory dir;
+    struct fs_dirent entry;
+    memset(&dir, 0, sizeof(dir));
+
+    // Obtenir offset du répertoire à supprimer, le parent et le répertoire sont verrouillés
+    int held[2], nheld;
+    int offset = dir_lock_entry(fs, parent.inum, name, &entry, held, &nheld);
     if (offset == -1) {
         dir.isvalid = 0;
         return dir;
     }
-
-    // Obtenir le block et l'offset
-    inum = parent.table[offset].inum;
-    blk_idx = inum / DIR_PER_BLOCK;
-    blk_off = inum % DIR_PER_BLOCK;
-    disque_read(zero.super.nblocks - 1 - blk_idx, blk.data);
-
-    dir = blk.directories[blk_off];
-    if (dir.isvalid == 0) {
+    if (entry.type != 0) {
+        inode_unlock_many(fs, held, nheld);
+        dir.isvalid = 0;
         return dir;
     }
 
     // Vérification du répertoire root
-    if (streq(dir.name, curr_dir.name)) {
+    if (streq(name, ".") || streq(name, "..") || entry.inum == FS_ROOT_INUM) {
         printf("Le répertoire racine ne peut pas etre supprimé\n");
+        inode_unlock_many(fs, held, nheld);
         dir.isvalid = 0;
         return dir;
     }
-
-    // Supprimer tous les Dirent dans le répertoire à supprimer
-    for (int ii = 0; ii < ENTRIES_PER_DIR; ii++) {
-        if ((ii > 1) && (dir.table[ii].isvalid == 1)) {
-            temp = rm_helper(dir, dir.table[ii].name);
-            if (temp.isvalid == 0)
-                return temp;
-            dir = temp;
-        }
-        dir.table[ii].isvalid = 0;
+    if (dir_in_use(fs, entry.inum)) {
+        printf("Répertoire courant d'une session\n");
+        inode_unlock_many(fs, held, nheld);
+        dir.isvalid = 0;
+        return dir;
     }
-    disque_read(zero.super.nblocks - 1 - blk_idx, blk.data);
-
-    // Réécris-le
-    dir.isvalid = 0;
-    blk.directories[blk_off] = dir;
-    disque_write(zero.super.nblocks - 1 - blk_idx, blk.data);
-
-    // Retirez-le du parent
-    parent.table[offset].isvalid = 0;
-    fs_write_dir_back(parent);
 
-    // Mettre à jour le compteur
-    dir_counter[blk_idx]--;
+    // Une fois détaché, le sous-arbre n'est plus accessible par son chemin
+    dir_erase(fs, parent.inum, offset);
+    inode_unlock_many(fs, held, nheld);
+    if (!tree_delete(fs, &entry)) {
+        dir.isvalid = 0;
+        return dir;
+    }
 
     return parent;
 }
 
+// Supprime un répertoire dans une transaction du journal
+struct fs_directory rmdir_child(struct sgf_mount *fs, struct fs_directory parent, char name[]) {
+    if (fs == NULL) {
+        struct fs_directory dir = {0};
+        return dir;
+    }
+    batch_begin(fs);
+    struct fs_directory dir = rmdir_entry(fs, parent, name);
+    batch_commit(fs);
+    return dir;
+}
+
 /**
  * Fonction d'aide pour supprimer un fichier/répertoire du répertoire parent.
  *
@@ -776,51 +5358,69 @@ struct fs_directory rmdir_child(struct fs_directory parent, char name[]) {
  * @param name Fichier ou répertoire à supprimer
  * @return Retourne le répertoire valide avec un bit=0, un bit valide en cas d'erreur.
  */
-struct fs_directory rm_helper(struct fs_directory dir, char name[]) {
-    if (bitmap == NULL) {
-        dir.isvalid = 0;
-        return dir;
-    }
-    // Obtenir le décalage pour la suppression
-    int offset = fs_dir_lookup(dir, name);
+static struct fs_directory rm_entry(struct sgf_mount *fs, struct fs_directory dir, char name[]) {
+    struct fs_dirent entry;
+    // Obtenir le décalage pour la suppression, le répertoire et le fichier sont verrouillés
+    int held[2], nheld;
+    int offset = dir_lock_entry(fs, dir.inum, name, &entry, held, &nheld);
     if (offset == -1) {
         dir.isvalid = 0;
         return dir;
     }
 
     // Vérifiez si le répertoire
-    if (dir.table[offset].type == 0) {
-        return rmdir_child(dir, name);
+    if (entry.type == 0) {
+        inode_unlock_many(fs, held, nheld);
+        return rmdir_entry(fs, dir, name);
     }
 
     // Obtenir le numéro d'entrée
-    int inum = dir.table[offset].inum;
+    int inum = entry.inum;
     printf("%u\n", inum);
     // Suppression de l'inode
-    if (!fs_delete(inum)) {
+    if (!file_delete(fs, inum)) {
         printf("Erreur de suppression inode\n");
+        inode_unlock_many(fs, held, nheld);
         dir.isvalid = 0;
         return dir;
     }
     //Supprimer l'entrée
-    dir.table[offset].isvalid = 0;
+    dir_erase(fs, dir.inum, offset);
+    inode_unlock_many(fs, held, nheld);
 
-    //Ecrire les modifications sur le répertoire
-    fs_write_dir_back(dir);
+    return dir;
+}
 
+// Supprime un fichier ou un répertoire dans une transaction du journal
+struct fs_directory rm_helper(struct sgf_mount *fs, struct fs_directory dir, char name[]) {
+    if (fs == NULL) {
+        dir.isvalid = 0;
+        return dir;
+    }
+    batch_begin(fs);
+    dir = rm_entry(fs, dir, name);
+    batch_commit(fs);
     return dir;
 }
 
 /**
  * Supprime le répertoire. Supprime également tous les répertoires et fichiers de sa table.
  *
- * @param name Nom du répertoire à supprimer
+ * @param name Chemin du répertoire à supprimer
  * @return
  */
-int fs_rmdir(char name[NAMESIZE]) {
-    struct fs_directory temp = rmdir_child(curr_dir, name);
-    if (temp.isvalid == 0) {
-        curr_dir = temp;
+int fs_rmdir(struct sgf_session *s, char name[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
+        return 0;
+    }
+    struct fs_directory parent;
+    char *leaf = path_split(s, name, &parent);
+    if (leaf == NULL) {
+        return 0;
+    }
+    struct fs_directory temp = rmdir_child(fs, parent, leaf);
+    if (temp.isvalid == 1) {
         return 1;
     }
     return 0;
@@ -829,14 +5429,536 @@ int fs_rmdir(char name[NAMESIZE]) {
 /**
  * Supprime le fichier/répertoire donné.
  *
- * @param name à supprimer
+ * @param name Chemin à supprimer
  * @return
  */
-int fs_rm(char name[]) {
-    struct fs_directory temp = rm_helper(curr_dir, name);
+int fs_rm(struct sgf_session *s, char name[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
+        return 0;
+    }
+    struct fs_directory parent;
+    char *leaf = path_split(s, name, &parent);
+    if (leaf == NULL) {
+        return 0;
+    }
+    struct fs_directory temp = rm_helper(fs, parent, leaf);
     if (temp.isvalid == 1) {
-        curr_dir = temp;
         return 1;
     }
     return 0;
 }
+
+/**
+ * Déplace une entrée sous rename_lock et les verrous d'inodes déjà pris. Rien n'est modifié
+ * tant que ces verrous ne couvrent pas tous les inodes touchés.
+ *
+ * @param held Indices des verrous pris
+ * @param nheld Nombre de verrous pris
+ * @param sparent Répertoire source
+ * @param sleaf Nom de la source
+ * @param dparent Répertoire de destination
+ * @param dleaf Nom de destination, vide pour garder le nom de la source
+ * @param inums Reçoit les inodes touchés : les deux répertoires, la source, le répertoire
+ *              de destination final et le fichier remplacé
+ * @return vrai en cas de succès, faux en cas d'erreur, -1 s'il manque des verrous
+ */
+static int rename_locked(struct sgf_mount *fs, const int held[], int nheld, int sparent, char *sleaf, int dparent, char *dleaf, int inums[]) {
+    struct fs_dirent entry, target;
+    int sslot = dir_find(fs, sparent, sleaf, &entry);
+    if (sslot == -1 || streq(sleaf, ".") || streq(sleaf, "..")) {
+        printf("Fichier introuvable\n");
+        return 0;
+    }
+
+    if (dparent == sparent && streq(dleaf, sleaf)) {
+        return 1;
+    }
+    if (*dleaf == '\0' || (dir_lookup_cached(fs, dparent, dleaf, &target) && target.type == 0)) {
+        if (*dleaf != '\0')
+            dparent = target.inum;
+        dleaf = sleaf;
+    }
+    if (strlen(dleaf) >= NAMESIZE) {
+        printf("Nom trop long\n");
+        return 0;
+    }
+    if (entry.type == 0 && dir_contains(fs, entry.inum, dparent)) {
+        printf("Un répertoire ne peut pas être déplacé dans lui-même\n");
+        return 0;
+    }
+
+    int dslot = dir_find(fs, dparent, dleaf, &target);
+    inums[2] = entry.inum;
+    inums[3] = dparent;
+    inums[4] = dslot != -1 ? target.inum : 0;
+    if (!inode_locks_cover(held, nheld, inums, 5)) {
+        return -1;
+    }
+
+    if (dslot != -1) {
+        if (target.inum == entry.inum) {
+            return 1;
+        }
+        if (target.type == 0 || entry.type == 0) {
+            printf("Ce nom de fichier existe déjà\n");
+            return 0;
+        }
+        // L'entrée existante désigne la source, l'ancien fichier est supprimé ensuite
+        dir_retarget(fs, dparent, dslot, entry.inum, entry.type);
+        dir_erase(fs, sparent, sslot);
+        file_delete(fs, target.inum);
+        return 1;
+    }
+
+    // La nouvelle entrée est écrite avant que l'ancienne ne disparaisse
+    if (dir_insert(fs, dparent, entry.inum, entry.type, dleaf) == -1) {
+        return 0;
+    }
+    if (entry.type == 0 && sparent != dparent) {
+        int dotdot = dir_find(fs, entry.inum, "..", NULL);
+        if (dotdot != -1)
+            dir_retarget(fs, entry.inum, dotdot, dparent, 0);
+    }
+
+    // L'ajout a pu partager une feuille du répertoire source et déplacer l'ancienne entrée
+    sslot = dir_find(fs, sparent, sleaf, NULL);
+    if (sslot != -1)
+        dir_erase(fs, sparent, sslot);
+    return 1;
+}
+
+/**
+ * Renomme ou déplace un fichier ou un répertoire. Seules les entrées de répertoire changent,
+ * les données ne sont pas copiées. Une destination qui est un répertoire existant reçoit
+ * l'entrée sous son nom actuel, un fichier existant est remplacé.
+ *
+ * @param src Chemin de l'entrée à déplacer
+ * @param dst Chemin de destination
+ * @return vrai en cas de succès
+ */
+int fs_rename(struct sgf_session *s, char src[], char dst[]) {
+    struct sgf_mount *fs = s ? s->fs : NULL;
+    if (fs == NULL) {
+        printf("Veuillez monter le disque\n");
+        return 0;
+    }
+
+    struct fs_directory sparent, dparent;
+    char *sleaf = path_split(s, src, &sparent);
+    char *dleaf = path_split(s, dst, &dparent);
+    if (sleaf == NULL || dleaf == NULL) {
+        printf("Chemin introuvable\n");
+        return 0;
+    }
+
+    // Les déplacements sont faits un par un : la vérification qu'un répertoire ne part pas
+    // dans son propre sous-arbre reste valable jusqu'à la fin du déplacement
+    batch_begin(fs);
+    pthread_mutex_lock(&fs->rename_lock);
+    int inums[5] = {sparent.inum, dparent.inum, 0, 0, 0};
+    int held[5];
+    int nheld = inode_lock_many(fs, inums, 2, held);
+    int ret;
+    for (;;) {
+        ret = rename_locked(fs, held, nheld, sparent.inum, sleaf, dparent.inum, dleaf, inums);
+        // Les inodes touchés sont connus une fois les répertoires lus : reprendre sous leurs verrous
+        if (ret != -1)
+            break;
+        inode_unlock_many(fs, held, nheld);
+        nheld = inode_lock_many(fs, inums, 5, held);
+    }
+    inode_unlock_many(fs, held, nheld);
+    pthread_mutex_unlock(&fs->rename_lock);
+    batch_commit(fs);
+    return ret;
+}
+
+/*
+ * Requêtes asynchrones. Une requête garde une copie des arguments de l'appel synchrone
+ * correspondant et est exécutée par l'un des threads du montage. Son résultat est passé au
+ * rappel de sa file s'il y en a un, sinon il attend dans la file d'être relevé par fs_aio_poll.
+ */
+
+struct fs_aio_req {
+    struct fs_aio *q;
+    struct fs_aio_result result;
+    int inumber;
+    char *data;               // FS_AIO_READ, FS_AIO_WRITE
+    int length;
+    int offset;
+    struct fs_directory dir;  // FS_AIO_READDIR : répertoire lu ; sinon répertoire courant à la soumission
+    struct fs_dirent *entries;
+    int max;
+    char *path;               // FS_AIO_CREATE, FS_AIO_LOOKUP
+    struct fs_aio_req *next;
+};
+
+struct fs_aio_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    struct fs_aio_req *head;  // Requêtes en attente d'un thread, dans l'ordre de soumission
+    struct fs_aio_req *tail;
+    int stop;
+    int nthreads;
+    pthread_t threads[FS_AIO_THREADS];
+};
+
+struct fs_aio {
+    struct sgf_session *session;
+    fs_aio_fn done;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;     // Une requête s'est terminée
+    struct fs_aio_req *head;  // Complétions pas encore relevées
+    struct fs_aio_req *tail;
+    int pending;              // Requêtes soumises et pas encore terminées
+    int efd;                  // Lisible tant qu'il reste des complétions, -1 avec un rappel
+};
+
+static void aio_execute(struct fs_aio_req *r) {
+    struct sgf_mount *fs = r->q->session->fs;
+    struct fs_aio_result *res = &r->result;
+    switch (res->op) {
+    case FS_AIO_READ:
+        res->ret = fs_read(fs, r->inumber, r->data, r->length, r->offset);
+        break;
+    case FS_AIO_WRITE:
+        res->ret = fs_write(fs, r->inumber, r->data, r->length, r->offset);
+        break;
+    case FS_AIO_CREATE: {
+        // Session propre à la requête, la session de la file pouvant changer de répertoire entre-temps
+        struct sgf_session s = {fs, r->dir, NULL};
+        res->ret = fs_touch(&s, r->path);
+        if (res->ret == 1 && !fs_resolve(fs, r->dir, r->path, &res->entry))
+            res->ret = 0;
+        break;
+    }
+    case FS_AIO_LOOKUP:
+        res->ret = fs_resolve(fs, r->dir, r->path, &res->entry);
+        break;
+    case FS_AIO_READDIR:
+        res->ret = fs_readdir(fs, r->dir, &res->cursor, r->entries, r->max);
+        break;
+    }
+}
+
+static void aio_req_free(struct fs_aio_req *r) {
+    free(r->path);
+    free(r);
+}
+
+/**
+ * Rend le résultat d'une requête exécutée, au rappel ou dans la file de complétions
+ */
+static void aio_complete(struct fs_aio_req *r) {
+    struct fs_aio *q = r->q;
+    if (q->done != NULL) {
+        q->done(&r->result);
+        aio_req_free(r);
+        pthread_mutex_lock(&q->lock);
+    } else {
+        r->next = NULL;
+        pthread_mutex_lock(&q->lock);
+        if (q->tail != NULL)
+            q->tail->next = r;
+        else
+            q->head = r;
+        q->tail = r;
+        eventfd_write(q->efd, 1);
+    }
+    // Une fois le verrou rendu, fs_aio_close peut libérer la file
+    q->pending--;
+    pthread_cond_broadcast(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *aio_worker(void *arg) {
+    struct fs_aio_pool *pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->head == NULL && !pool->stop)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        struct fs_aio_req *r = pool->head;
+        if (r == NULL)
+            break;
+        pool->head = r->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        aio_execute(r);
+        aio_complete(r);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * Démarre les threads des requêtes asynchrones d'un montage s'ils ne tournent pas déjà
+ *
+ * @return vrai si au moins un thread tourne
+ */
+static int aio_pool_start(struct sgf_mount *fs) {
+    pthread_mutex_lock(&fs->session_lock);
+    if (fs->aio == NULL) {
+        struct fs_aio_pool *pool = calloc(1, sizeof(struct fs_aio_pool));
+        if (pool != NULL) {
+            pthread_mutex_init(&pool->lock, NULL);
+            pthread_cond_init(&pool->work, NULL);
+            while (pool->nthreads < FS_AIO_THREADS
+                   && thread_start(&pool->threads[pool->nthreads], aio_worker, pool) == 0)
+                pool->nthreads++;
+            if (pool->nthreads == 0) {
+                pthread_cond_destroy(&pool->work);
+                pthread_mutex_destroy(&pool->lock);
+                free(pool);
+                pool = NULL;
+            }
+        }
+        fs->aio = pool;
+    }
+    int ok = fs->aio != NULL;
+    pthread_mutex_unlock(&fs->session_lock);
+    return ok;
+}
+
+// Arrête les threads des requêtes asynchrones, toutes les files étant fermées
+static void aio_pool_stop(struct sgf_mount *fs) {
+    struct fs_aio_pool *pool = fs->aio;
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+    fs->aio = NULL;
+}
+
+/**
+ * Ouvre une file de requêtes asynchrones sur une session. La file doit être fermée
+ * avant la session, et n'être utilisée que par le thread qui se sert de la session.
+ *
+ * @param done Appelé par un thread interne à la fin de chaque requête ; NULL pour
+ *             relever les résultats avec fs_aio_poll
+ * @return La file, NULL en cas d'échec
+ */
+struct fs_aio *fs_aio_open(struct sgf_session *s, fs_aio_fn done) {
+    if (s == NULL || !aio_pool_start(s->fs)) {
+        return NULL;
+    }
+    struct fs_aio *q = calloc(1, sizeof(struct fs_aio));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->session = s;
+    q->done = done;
+    q->efd = -1;
+    if (done == NULL && (q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->ready, NULL);
+    return q;
+}
+
+/**
+ * Attend la fin des requêtes d'une file, abandonne les résultats non relevés et ferme la file
+ */
+void fs_aio_close(struct fs_aio *q) {
+    if (q == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&q->lock);
+    while (q->pending > 0)
+        pthread_cond_wait(&q->ready, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+    while (q->head != NULL) {
+        struct fs_aio_req *r = q->head;
+        q->head = r->next;
+        aio_req_free(r);
+    }
+    if (q->efd >= 0)
+        close(q->efd);
+    pthread_cond_destroy(&q->ready);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+/**
+ * Descripteur à surveiller avec poll ou epoll : lisible tant que fs_aio_poll a des résultats à rendre
+ *
+ * @return Le descripteur, -1 si la file a un rappel
+ */
+int fs_aio_fd(struct fs_aio *q) {
+    return q ? q->efd : -1;
+}
+
+static struct fs_aio_req *aio_req_new(struct fs_aio *q, const char path[]) {
+    if (q == NULL) {
+        return NULL;
+    }
+    struct fs_aio_req *r = calloc(1, sizeof(struct fs_aio_req));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->q = q;
+    r->dir = fs_getcwd(q->session);
+    if (path != NULL && (r->path = strdup(path)) == NULL) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * Met une requête dans la file des threads du montage
+ *
+ * @return Jeton de la requête, recopié dans son résultat
+ */
+static long aio_submit(struct fs_aio_req *r, int op, void *arg) {
+    struct fs_aio *q = r->q;
+    struct sgf_mount *fs = q->session->fs;
+    struct fs_aio_pool *pool = fs->aio;
+    long token = __atomic_add_fetch(&fs->aio_token, 1, __ATOMIC_RELAXED);
+    r->result.token = token;
+    r->result.op = op;
+    r->result.arg = arg;
+
+    pthread_mutex_lock(&q->lock);
+    q->pending++;
+    pthread_mutex_unlock(&q->lock);
+
+    // La requête peut se terminer et être libérée dès que le verrou est rendu
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL)
+        pool->tail->next = r;
+    else
+        pool->head = r;
+    pool->tail = r;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return token;
+}
+
+/**
+ * Variante asynchrone de fs_read : data doit rester valide jusqu'à la fin de la requête
+ *
+ * @return Jeton de la requête, -1 en cas d'échec
+ */
+long fs_aio_read(struct fs_aio *q, int inumber, char *data, int length, int offset, void *arg) {
+    struct fs_aio_req *r = aio_req_new(q, NULL);
+    if (r == NULL) {
+        return -1;
+    }
+    r->inumber = inumber;
+    r->data = data;
+    r->length = length;
+    r->offset = offset;
+    return aio_submit(r, FS_AIO_READ, arg);
+}
+
+/**
+ * Variante asynchrone de fs_write : data doit rester valide jusqu'à la fin de la requête
+ *
+ * @return Jeton de la requête, -1 en cas d'échec
+ */
+long fs_aio_write(struct fs_aio *q, int inumber, const char *data, int length, int offset, void *arg) {
+    struct fs_aio_req *r = aio_req_new(q, NULL);
+    if (r == NULL) {
+        return -1;
+    }
+    r->inumber = inumber;
+    r->data = (char *) data;
+    r->length = length;
+    r->offset = offset;
+    return aio_submit(r, FS_AIO_WRITE, arg);
+}
+
+/**
+ * Variante asynchrone de fs_touch, suivie de la recherche du fichier créé
+ *
+ * @param path Chemin du fichier, relatif au répertoire courant de la session à la soumission
+ * @return Jeton de la requête, -1 en cas d'échec
+ */
+long fs_aio_create(struct fs_aio *q, const char path[], void *arg) {
+    struct fs_aio_req *r = aio_req_new(q, path);
+    if (r == NULL || r->path == NULL) {
+        free(r);
+        return -1;
+    }
+    return aio_submit(r, FS_AIO_CREATE, arg);
+}
+
+/**
+ * Variante asynchrone de fs_resolve
+ *
+ * @param path Chemin, relatif au répertoire courant de la session à la soumission
+ * @return Jeton de la requête, -1 en cas d'échec
+ */
+long fs_aio_lookup(struct fs_aio *q, const char path[], void *arg) {
+    struct fs_aio_req *r = aio_req_new(q, path);
+    if (r == NULL || r->path == NULL) {
+        free(r);
+        return -1;
+    }
+    return aio_submit(r, FS_AIO_LOOKUP, arg);
+}
+
+/**
+ * Variante asynchrone de fs_readdir : le curseur du lot suivant est rendu dans le résultat,
+ * entries doit rester valide jusqu'à la fin de la requête
+ *
+ * @return Jeton de la requête, -1 en cas d'échec
+ */
+long fs_aio_readdir(struct fs_aio *q, struct fs_directory dir, int cursor, struct fs_dirent entries[], int max, void *arg) {
+    struct fs_aio_req *r = aio_req_new(q, NULL);
+    if (r == NULL) {
+        return -1;
+    }
+    r->dir = dir;
+    r->entries = entries;
+    r->max = max;
+    r->result.cursor = cursor;
+    return aio_submit(r, FS_AIO_READDIR, arg);
+}
+
+/**
+ * Relève les résultats des requêtes terminées, dans leur ordre de fin
+ *
+ * @param results Reçoit au plus max résultats
+ * @param wait Vrai pour attendre un résultat s'il reste des requêtes en cours ; avec un
+ *             rappel, attend la fin de toutes les requêtes de la file
+ * @return Nombre de résultats rendus, -1 si la file est invalide
+ */
+int fs_aio_poll(struct fs_aio *q, struct fs_aio_result results[], int max, int wait) {
+    if (q == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&q->lock);
+    while (wait && q->head == NULL && q->pending > 0)
+        pthread_cond_wait(&q->ready, &q->lock);
+    int n = 0;
+    while (n < max && q->head != NULL) {
+        struct fs_aio_req *r = q->head;
+        q->head = r->next;
+        results[n++] = r->result;
+        aio_req_free(r);
+    }
+    if (q->head == NULL) {
+        q->tail = NULL;
+        if (q->efd >= 0) {
+            eventfd_t count;
+            eventfd_read(q->efd, &count);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
@@ -10,17 +10,72 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <math.h>
+#include <pthread.h>
 
 #define streq(a, b) (strcmp((a), (b)) == 0)
 
 #define POINTERS_PER_BLOCK 1024
 #define INODES_PER_BLOCK 128
-#define POINTERS_PER_INODE 5
+#define POINTERS_PER_INODE 4
 #define FS_MAGIC 0xf0f03410
+#define FS_CLEAN 1        // Démonté proprement : les bitmaps sur disque sont à jour
 
-#define NAMESIZE 16       // Taille du nom des fichiers et répertoires définie
-#define ENTRIES_PER_DIR 7 // Nombre maximum des fichiers et répertoire dans un répertoire
-#define DIR_PER_BLOCK 8   // Nombre de répertoire par block
+#define NAMESIZE 256      // Taille maximale du nom des fichiers et répertoires, terminateur compris
+#define FS_ROOT_INUM 1    // Inode du répertoire racine
+
+// Drapeaux du champ isvalid d'un inode
+#define INODE_VALID 1
+#define INODE_DIR 2       // Les données de l'inode sont des entrées de répertoire
+#define INODE_INDEX 4     // Répertoire indexé par hachage, son bloc 0 est la racine de l'index
+
+#define DX_MAGIC 0x48545245 // Bloc d'index d'un répertoire
+
+// Nombre maximal de blocs d'un fichier : directs, indirects puis doublement indirects
+#define MAX_FILE_BLOCKS (POINTERS_PER_INODE + POINTERS_PER_BLOCK + POINTERS_PER_BLOCK * POINTERS_PER_BLOCK)
+
+#define LAZY_GROUP_BLOCKS 64   // Nombre minimal de blocs d'un groupe de la table des inodes
+#define LAZY_MAX_GROUPS 16384  // Nombre maximal de groupes suivis par le superbloc
+
+#define FS_SEEK_DATA 3    // fs_lseek : prochaine zone de données
+#define FS_SEEK_HOLE 4    // fs_lseek : prochain trou
+
+#define DCACHE_SIZE 8192  // Nombre d'entrées du cache des noms
+#define DIRCACHE_DIRS 32  // Nombre de répertoires gardés entièrement en mémoire
+#define DIRBLOOM_DIRS 1024 // Nombre de filtres de Bloom de répertoires
+#define DIRBLOOM_PROBES 4  // Bits testés par nom dans un filtre de Bloom
+#define FS_READDIR_BATCH 128 // Entrées lues par lot pour ls -l
+#define FS_WALK_THREADS 16   // Nombre maximal de threads d'un parcours d'arborescence
+#define FS_PATHSIZE 4096     // Taille maximale d'un chemin rendu par fs_walk
+#define FS_AIO_THREADS 8     // Threads qui exécutent les requêtes asynchrones d'un montage
+
+#define FS_JOURNAL_RATIO 32    // Un bloc de journal pour 32 blocs du disque
+#define FS_JOURNAL_MIN 16      // En dessous, le disque est formaté sans journal
+#define FS_JOURNAL_MAX 8192    // Taille maximale de la zone du journal
+#define FS_JOURNAL_DELAY 5000  // Délai en ms avant la validation de la transaction ouverte
+
+#define FS_INODE_LOCKS 1024  // Verrous lecteurs-rédacteurs des inodes, répartis par numéro d'inode
+#define FS_TABLE_LOCKS 256   // Verrous des blocs de la table des inodes
+#define FS_ALLOC_GROUP 8192  // Blocs par groupe de l'allocateur, chacun avec son verrou
+#define FS_CACHE_BUCKETS 256 // Compartiments du cache d'écriture
+#define FS_READERS 64        // Lectures simultanées sans verrou des caches de répertoires
+#define FS_RETIRE_BATCH 64   // Mémoire retirée des caches avant une tentative de libération
+
+#define TAIL_MAGIC 0x7a11b10c
+
+#define JOURNAL_MAGIC 0x4a524e4c  // En-tête de la zone du journal
+#define JOURNAL_DESC 0x4a444553   // Descripteur d'une transaction
+#define JOURNAL_COMMIT 0x4a434d54 // Fin d'une transaction
+#define TAIL_SLOTS 32     // Nombre d'emplacements dans un bloc de fragments
+#define TAIL_MAX 2048     // Taille maximale d'une fin de fichier rangée dans un bloc de fragments
+
+// Position d'un inode dans la table des inodes
+#define INODE_BLOC(inumber) (1 + (inumber) / INODES_PER_BLOCK)
+#define INODE_OFFSET(inumber) ((inumber) % INODES_PER_BLOCK)
+
+// Un pointeur négatif désigne un fragment (bloc de fragments, emplacement) et non un bloc entier
+#define TAIL_REF(bloc, slot) (-((bloc) * TAIL_SLOTS + (slot)) - 1)
+#define TAIL_BLOC(ref) ((-(ref) - 1) / TAIL_SLOTS)
+#define TAIL_SLOT(ref) ((-(ref) - 1) % TAIL_SLOTS)
 
 // Structures des objets du système de fichier
 
@@ -29,7 +84,15 @@ struct fs_superblock {
     int nblocks;
     int ninodeblocks;
     int ninodes;
-    int ndirblocks;
+    int groupblocks;   // Taille des groupes de la table des inodes
+    int ninodegroups;
+    int state;         // FS_CLEAN, ou 0 tant que le disque est monté
+    int mapstart;      // Bitmaps des blocs utilisés, des blocs de fragments puis des inodes
+    int mapblocks;
+    int datastart;     // Premier bloc de données
+    unsigned char uninit[LAZY_MAX_GROUPS / 8]; // Groupes jamais écrits, lus comme des zéros
+    int journalstart;  // Zone du journal des métadonnées, entre les bitmaps et les données
+    int journalblocks; // 0 si le disque n'a pas de journal
 };
 
 struct fs_inode {
@@ -37,8 +100,10 @@ struct fs_inode {
     int size;
     int direct[POINTERS_PER_INODE];
     int indirect;
+    int dindirect;
 };
 
+// Entrée de répertoire décodée
 struct fs_dirent {
     int type;
     int isvalid;
@@ -46,11 +111,126 @@ struct fs_dirent {
     char name[NAMESIZE];
 };
 
+// Enregistrement d'une entrée dans un bloc de répertoire, les enregistrements se suivent
+// et leurs longueurs couvrent tout le bloc
+struct fs_dirrec {
+    int inum;                 // 0 si l'enregistrement est libre
+    unsigned short rec_len;   // Distance jusqu'à l'enregistrement suivant
+    unsigned char name_len;
+    unsigned char type;       // type = 1 pour fichier , type = 0 pour répertoire
+    char name[];              // Sans terminateur
+};
+
+// Taille minimale d'un enregistrement, alignée sur 4 octets
+#define DIRREC_LEN(name_len) ((int) ((sizeof(struct fs_dirrec) + (name_len) + 3) & ~3))
+
+// Entrée d'index : le bloc couvre les hachages à partir de hash
+struct fs_dxentry {
+    unsigned int hash;
+    int block;        // Index du bloc dans le répertoire
+};
+
+#define DX_ENTRIES ((int) ((BLOCK_SIZE - 3 * sizeof(int)) / sizeof(struct fs_dxentry)))
+
+// Racine ou noeud intermédiaire de l'index d'un répertoire
+struct fs_dxblock {
+    int magic;
+    int levels;       // Racine seulement : 1 si ses entrées désignent des noeuds intermédiaires
+    int count;
+    struct fs_dxentry entries[DX_ENTRIES];
+};
+
+// Référence vers un répertoire, ses entrées sont dans les blocs de données de son inode
 struct fs_directory {
     int isvalid;
     int inum;
     char name[NAMESIZE];
-    struct fs_dirent table[ENTRIES_PER_DIR];
+};
+
+// Attributs d'un inode rendus par fs_stat_many
+struct fs_stat {
+    int inum;
+    int isvalid;      // Drapeaux de l'inode, 0 s'il est libre
+    int size;
+};
+
+// Entrée visitée par fs_walk
+struct fs_walkent {
+    int inum;
+    int type;
+    int size;
+    int depth;                // 1 pour le contenu du répertoire de départ
+    char path[FS_PATHSIZE];   // Chemin depuis le répertoire de départ
+};
+
+typedef void (*fs_walk_fn)(const struct fs_walkent *entry, void *arg);
+
+// Requêtes asynchrones, champ op de struct fs_aio_result
+#define FS_AIO_READ 1
+#define FS_AIO_WRITE 2
+#define FS_AIO_CREATE 3
+#define FS_AIO_LOOKUP 4
+#define FS_AIO_READDIR 5
+
+// Fin d'une requête asynchrone
+struct fs_aio_result {
+    long token;               // Rendu à la soumission
+    int op;
+    int ret;                  // Résultat de l'appel synchrone correspondant
+    void *arg;                // Donné à la soumission
+    struct fs_dirent entry;   // FS_AIO_CREATE, FS_AIO_LOOKUP : fichier créé ou trouvé
+    int cursor;               // FS_AIO_READDIR : curseur du lot suivant
+};
+
+typedef void (*fs_aio_fn)(const struct fs_aio_result *result);
+
+// File de requêtes asynchrones d'une session, rendue par fs_aio_open
+struct fs_aio;
+
+struct fs_tailslot {
+    int inum;   // Inode propriétaire, 0 si l'emplacement est libre
+    int offset; // Position du fragment dans la zone de données
+    int length;
+};
+
+#define TAIL_DATA (BLOCK_SIZE - 2 * sizeof(int) - TAIL_SLOTS * sizeof(struct fs_tailslot))
+
+struct fs_tailblock {
+    int magic;
+    int nused;
+    struct fs_tailslot slots[TAIL_SLOTS];
+    char data[TAIL_DATA];
+};
+
+/*
+ * Journal des métadonnées : le premier bloc de la zone est un en-tête, les transactions
+ * s'écrivent à la suite dans le reste de la zone, en revenant au début une fois au bout.
+ * Une transaction est une suite de descripteurs, chacun suivi des copies des blocs qu'il
+ * nomme, puis un bloc de fin. Elle n'est rejouée que si son bloc de fin est intact.
+ */
+struct fs_jsuper {
+    int magic;
+    unsigned int seq;   // Numéro de la première transaction à rejouer
+    int tail;           // Sa position dans la zone
+    int rescan;         // Des blocs sont écrits sur place sans le journal : les bitmaps sont à reconstruire
+};
+
+#define JOURNAL_TAGS ((int) ((BLOCK_SIZE - 4 * sizeof(int)) / sizeof(int)))
+
+struct fs_jdesc {
+    int magic;
+    unsigned int seq;
+    int count;          // Blocs qui suivent le descripteur
+    int pad;
+    int blocs[JOURNAL_TAGS];
+};
+
+struct fs_jcommit {
+    int magic;
+    unsigned int seq;
+    int count;          // Blocs de la transaction, descripteurs non compris
+    int pad;
+    uint64_t sum;       // Somme de contrôle des blocs et de leurs numéros
 };
 
 union fs_block {
@@ -58,54 +238,113 @@ union fs_block {
     struct fs_inode inode[INODES_PER_BLOCK];
     int pointers[POINTERS_PER_BLOCK];
     char data[BLOCK_SIZE];
-    struct fs_directory directories[DIR_PER_BLOCK];
+    struct fs_dxblock dx;
+    struct fs_tailblock tail;
+    struct fs_jsuper jsuper;
+    struct fs_jdesc jdesc;
+    struct fs_jcommit jcommit;
 };
 
-int free_block[BLOCKS];
-int inode_counter[BLOCKS];
-int dir_counter[BLOCKS];
-struct fs_directory curr_dir;
+// Système de fichiers monté, rendu par fs_mount
+struct sgf_mount;
+
+// Session d'un client sur un montage, avec son propre répertoire courant
+struct sgf_session;
 
 // fonctions principales
 
-int fs_format();
+int fs_format(struct sgf_disk *disk);
+
+struct sgf_mount *fs_mount(struct sgf_disk *disk);
+
+int fs_umount(struct sgf_mount *fs);
+
+int fs_lazy_init(struct sgf_mount *fs);
+
+int fs_sync(struct sgf_mount *fs);
+
+struct sgf_session *fs_session_open(struct sgf_mount *fs);
+
+void fs_session_close(struct sgf_session *s);
+
+struct fs_directory fs_getcwd(struct sgf_session *s);
+
+int fs_create(struct sgf_mount *fs);
 
-int fs_mount();
+int fs_delete(struct sgf_mount *fs, int inumber);
 
-int fs_create();
+int fs_truncate(struct sgf_mount *fs, int inumber, int newsize);
 
-int fs_delete(int inumber);
+int fs_read(struct sgf_mount *fs, int inumber, char *data, int length, int offset);
 
-int fs_read(int inumber, char *data, int length, int offset);
+int fs_write(struct sgf_mount *fs, int inumber, const char *data, int length, int offset);
 
-int fs_write(int inumber, const char *data, int length, int offset);
+int fs_lseek(struct sgf_mount *fs, int inumber, int offset, int whence);
+
+int fs_fsync(struct sgf_mount *fs, int inumber);
 
 // Fonctions définissant des actions sur les répertoires et les fichiers
 
-struct fs_directory fs_read_dir_from_offset(int offset);
+struct fs_directory fs_read_dir_from_offset(struct sgf_session *s, int offset);
+
+struct fs_directory rmdir_child(struct sgf_mount *fs, struct fs_directory parent, char name[]);
+
+struct fs_directory rm_helper(struct sgf_mount *fs, struct fs_directory parent, char name[]);
+
+int fs_touch(struct sgf_session *s, char name[]);
+
+int fs_create_many(struct sgf_mount *fs, struct fs_directory dir, char *names[], int n);
+
+int fs_mkdir(struct sgf_session *s, char name[]);
+
+int fs_rmdir(struct sgf_session *s, char name[]);
+
+int fs_cd(struct sgf_session *s, char name[]);
+
+int fs_ls(struct sgf_session *s);
+
+int fs_rm(struct sgf_session *s, char name[]);
+
+int fs_dir(struct sgf_session *s, char name[]);
+
+int fs_rename(struct sgf_session *s, char src[], char dst[]);
+
+int fs_readdir(struct sgf_mount *fs, struct fs_directory dir, int *cursor, struct fs_dirent entries[], int max);
+
+int fs_stat_many(struct sgf_mount *fs, const int inums[], struct fs_stat stats[], int n);
+
+int fs_ls_long(struct sgf_session *s);
+
+int fs_walk(struct sgf_mount *fs, struct fs_directory dir, fs_walk_fn visit, void *arg);
+
+int fs_du(struct sgf_session *s, char path[]);
+
+int fs_find(struct sgf_session *s, char path[], char pattern[]);
+
+int fs_tree(struct sgf_session *s, char path[]);
 
-struct fs_directory rmdir_child(struct fs_directory parent, char name[]);
+struct fs_directory fs_add_dir_entry(struct sgf_mount *fs, struct fs_directory dir, int inum, int type, char name[]);
 
-struct fs_directory rm_helper(struct fs_directory parent, char name[]);
+int fs_dir_lookup(struct sgf_mount *fs, struct fs_directory dir, char name[], struct fs_dirent *entry);
 
-int fs_touch(char name[NAMESIZE]);
+int fs_resolve(struct sgf_mount *fs, struct fs_directory dir, const char path[], struct fs_dirent *entry);
 
-int fs_mkdir(char name[]);
+struct fs_aio *fs_aio_open(struct sgf_session *s, fs_aio_fn done);
 
-int fs_rmdir(char name[]);
+void fs_aio_close(struct fs_aio *q);
 
-int fs_cd(char name[]);
+int fs_aio_fd(struct fs_aio *q);
 
-int fs_ls();
+long fs_aio_read(struct fs_aio *q, int inumber, char *data, int length, int offset, void *arg);
 
-int fs_rm(char name[]);
+long fs_aio_write(struct fs_aio *q, int inumber, const char *data, int length, int offset, void *arg);
 
-int fs_dir(char name[]);
+long fs_aio_create(struct fs_aio *q, const char path[], void *arg);
 
-struct fs_directory fs_add_dir_entry(struct fs_directory dir, int inum, int type, char name[]);
+long fs_aio_lookup(struct fs_aio *q, const char path[], void *arg);
 
-void fs_write_dir_back(struct fs_directory dir);
+long fs_aio_readdir(struct fs_aio *q, struct fs_directory dir, int cursor, struct fs_dirent entries[], int max, void *arg);
 
-int fs_dir_lookup(struct fs_directory dir, char name[]);
+int fs_aio_poll(struct fs_aio *q, struct fs_aio_result results[], int max, int wait);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include "sgfclient.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct sgfc {
+    int fd;
+    uint32_t next_id;
+    pthread_mutex_t lock;
+    char *req;          // Trame en construction
+    size_t reqlen;
+    size_t reqcap;
+    char *reply;        // Données de la dernière réponse
+    size_t replycap;
+};
+
+static int req_put(struct sgfc *c, const void *data, size_t n) {
+    if (c->reqlen + n > c->reqcap) {
+        size_t cap = c->reqcap ? c->reqcap : 4096;
+        while (cap < c->reqlen + n)
+            cap *= 2;
+        char *req = realloc(c->req, cap);
+        if (req == NULL) {
+            return 0;
+        }
+        c->req = req;
+        c->reqcap = cap;
+    }
+    memcpy(c->req + c->reqlen, data, n);
+    c->reqlen += n;
+    return 1;
+}
+
+static int req_put32(struct sgfc *c, int32_t v) {
+    return req_put(c, &v, sizeof(v));
+}
+
+/**
+ * Commence une trame dans la requête en construction
+ *
+ * @param at Reçoit la position de son en-tête, complété par frame_end
+ * @return faux si la mémoire manque
+ */
+static int frame_begin(struct sgfc *c, int op, uint32_t id, size_t *at) {
+    struct sgfp_header hdr = {0, id, op, 0, 0};
+    *at = c->reqlen;
+    return req_put(c, &hdr, sizeof(hdr));
+}
+
+// Complète l'en-tête d'une trame avec la longueur de ses données, faux si elle est trop grande
+static int frame_end(struct sgfc *c, size_t at) {
+    uint32_t length = c->reqlen - at - sizeof(struct sgfp_header);
+    memcpy(c->req + at, &length, sizeof(length));
+    return c->reqlen - at - sizeof(struct sgfp_header) <= SGFP_MAX_PAYLOAD;
+}
+
+// Ajoute la trame d'une requête, faux si elle est trop grande ou si la mémoire manque
+static int op_encode(struct sgfc *c, const struct sgfc_op *op, uint32_t id) {
+    size_t at;
+    size_t len = op->path ? strlen(op->path) : 0;
+    if (!frame_begin(c, op->op, id, &at)) {
+        return 0;
+    }
+    int ok;
+    switch (op->op) {
+        case SGFP_OPEN:
+            ok = req_put32(c, op->flags) && req_put(c, op->path, len);
+            break;
+        case SGFP_READ:
+            ok = req_put32(c, op->inum) && req_put32(c, op->offset) && req_put32(c, op->length);
+            break;
+        case SGFP_WRITE:
+            ok = op->length >= 0 && op->length <= SGFP_MAX_DATA
+                 && req_put32(c, op->inum) && req_put32(c, op->offset) && req_put(c, op->buf, op->length);
+            break;
+        case SGFP_MKDIR:
+            ok = req_put(c, op->path, len);
+            break;
+        case SGFP_RENAME:
+            ok = req_put32(c, len) && req_put(c, op->path, len) && req_put(c, op->path2, strlen(op->path2));
+            break;
+        default:
+            ok = 0;
+    }
+    return frame_end(c, at) && ok;
+}
+
+// Reporte la réponse d'une requête dans sa description
+static void op_decode(struct sgfc_op *op, const struct sgfp_header *hdr, const char *data) {
+    op->status = hdr->status;
+    if (op->op == SGFP_READ && hdr->status > 0) {
+        uint32_t n = hdr->length < (uint32_t) op->length ? hdr->length : (uint32_t) op->length;
+        memcpy(op->buf, data, n);
+        op->status = n;
+    } else if (op->op == SGFP_OPEN && op->buf != NULL && hdr->length == sizeof(struct sgfp_attr)) {
+        memcpy(op->buf, data, sizeof(struct sgfp_attr));
+    }
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            return 0;
+        }
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int recv_all(int fd, char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            return 0;
+        }
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/**
+ * Envoie la requête construite et reçoit sa réponse dans c->reply
+ *
+ * @param reply Reçoit l'en-tête de la réponse
+ * @return vrai en cas de succès
+ */
+static int exchange(struct sgfc *c, uint32_t id, struct sgfp_header *reply) {
+    if (!send_all(c->fd, c->req, c->reqlen) || !recv_all(c->fd, (char *) reply, sizeof(*reply))) {
+        return 0;
+    }
+    if (reply->length > SGFP_MAX_PAYLOAD || reply->id != id) {
+        return 0;
+    }
+    if (reply->length > c->replycap) {
+        char *data = realloc(c->reply, reply->length);
+        if (data == NULL) {
+            return 0;
+        }
+        c->reply = data;
+        c->replycap = reply->length;
+    }
+    return recv_all(c->fd, c->reply, reply->length);
+}
+
+// Exécute une requête seule
+static int call(struct sgfc *c, struct sgfc_op *op) {
+    struct sgfp_header reply;
+    pthread_mutex_lock(&c->lock);
+    uint32_t id = c->next_id++;
+    c->reqlen = 0;
+    int ok = op_encode(c, op, id) && exchange(c, id, &reply);
+    if (ok)
+        op_decode(op, &reply, c->reply);
+    pthread_mutex_unlock(&c->lock);
+    return ok ? op->status : -1;
+}
+
+/**
+ * Se connecte à sgfd
+ *
+ * @param path Chemin de la socket du serveur
+ * @return Connexion, NULL en cas d'erreur
+ */
+struct sgfc *sgfc_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct sgfc *c = calloc(1, sizeof(struct sgfc));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        if (c->fd >= 0)
+            close(c->fd);
+        free(c);
+        return NULL;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+void sgfc_close(struct sgfc *c) {
+    if (c == NULL) {
+        return;
+    }
+    close(c->fd);
+    pthread_mutex_destroy(&c->lock);
+    free(c->req);
+    free(c->reply);
+    free(c);
+}
+
+/**
+ * Cherche un fichier ou un répertoire, en créant au besoin le fichier
+ *
+ * @param path Chemin absolu ou relatif à la racine
+ * @param flags SGFP_CREATE pour créer le fichier s'il n'existe pas
+ * @param attr Reçoit les attributs, peut être NULL
+ * @return 1 si le chemin existe, 0 sinon
+ */
+int sgfc_open(struct sgfc *c, const char *path, int flags, struct sgfp_attr *attr) {
+    struct sgfc_op op = {.op = SGFP_OPEN, .flags = flags, .path = path, .buf = attr};
+    return call(c, &op);
+}
+
+// Lit au plus length octets d'un fichier, rend le nombre d'octets lus
+int sgfc_read(struct sgfc *c, int inum, char *data, int length, int offset) {
+    struct sgfc_op op = {.op = SGFP_READ, .inum = inum, .offset = offset, .length = length, .buf = data};
+    return call(c, &op);
+}
+
+// Écrit dans un fichier, rend le nombre d'octets écrits
+int sgfc_write(struct sgfc *c, int inum, const char *data, int length, int offset) {
+    struct sgfc_op op = {.op = SGFP_WRITE, .inum = inum, .offset = offset, .length = length, .buf = (void *) data};
+    return call(c, &op);
+}
+
+int sgfc_mkdir(struct sgfc *c, const char *path) {
+    struct sgfc_op op = {.op = SGFP_MKDIR, .path = path};
+    return call(c, &op);
+}
+
+int sgfc_rename(struct sgfc *c, const char *src, const char *dst) {
+    struct sgfc_op op = {.op = SGFP_RENAME, .path = src, .path2 = dst};
+    return call(c, &op);
+}
+
+/**
+ * Lit les attributs de plusieurs inodes en une requête
+ *
+ * @return Nombre d'inodes valides
+ */
+int sgfc_stat(struct sgfc *c, const int inums[], struct sgfp_stat stats[], int n) {
+    struct sgfp_header reply;
+    pthread_mutex_lock(&c->lock);
+    uint32_t id = c->next_id++;
+    c->reqlen = 0;
+    size_t at;
+    int ok = n >= 0 && frame_begin(c, SGFP_STAT, id, &at) && req_put(c, inums, n * sizeof(int32_t))
+             && frame_end(c, at) && exchange(c, id, &reply);
+    if (ok && reply.status >= 0 && reply.length == n * sizeof(struct sgfp_stat))
+        memcpy(stats, c->reply, reply.length);
+    pthread_mutex_unlock(&c->lock);
+    return ok ? reply.status : -1;
+}
+
+/**
+ * Lit les entrées d'un répertoire par lots, comme fs_readdir
+ *
+ * @param dir Inode du répertoire
+ * @param cursor Position de reprise, 0 pour commencer, mise à jour
+ * @param max Nombre maximal d'entrées, au plus FS_READDIR_BATCH
+ * @return Nombre d'entrées rendues, 0 à la fin du répertoire
+ */
+int sgfc_readdir(struct sgfc *c, int dir, int *cursor, struct sgfc_dirent entries[], int max) {
+    struct sgfp_header reply;
+    pthread_mutex_lock(&c->lock);
+    uint32_t id = c->next_id++;
+    c->reqlen = 0;
+    size_t at;
+    int ok = frame_begin(c, SGFP_READDIR, id, &at) && req_put32(c, dir) && req_put32(c, *cursor)
+             && req_put32(c, max) && frame_end(c, at) && exchange(c, id, &reply);
+
+    int n = ok ? reply.status : -1;
+    if (n > 0 && (n > max || reply.length < sizeof(int32_t))) {
+        n = -1;
+    }
+    if (n >= 0 && reply.length >= sizeof(int32_t)) {
+        memcpy(cursor, c->reply, sizeof(int32_t));
+        size_t off = sizeof(int32_t);
+        for (int i = 0; i < n; i++) {
+            struct sgfp_dirent de;
+            if (reply.length - off < sizeof(de)) {
+                n = -1;
+                break;
+            }
+            memcpy(&de, c->reply + off, sizeof(de));
+            off += sizeof(de);
+            if (reply.length - off < de.name_len) {
+                n = -1;
+                break;
+            }
+            entries[i].inum = de.inum;
+            entries[i].type = de.type;
+            memcpy(entries[i].name, c->reply + off, de.name_len);
+            entries[i].name[de.name_len] = '\0';
+            off += de.name_len;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    return n;
+}
+
+/**
+ * Exécute plusieurs requêtes en un aller-retour, dans l'ordre. Le status de chacune est
+ * rendu dans sa description, ses données dans son tampon.
+ *
+ * @return Nombre de requêtes exécutées par le serveur
+ */
+int sgfc_batch(struct sgfc *c, struct sgfc_op ops[], int n) {
+    struct sgfp_header reply;
+    pthread_mutex_lock(&c->lock);
+    uint32_t id = c->next_id++;
+    c->reqlen = 0;
+    size_t at;
+    int ok = frame_begin(c, SGFP_BATCH, id, &at);
+    for (int i = 0; ok && i < n; i++)
+        ok = op_encode(c, &ops[i], i);
+    ok = ok && frame_end(c, at) && exchange(c, id, &reply);
+
+    int done = ok ? reply.status : -1;
+    size_t off = 0;
+    for (int i = 0; done > 0 && i < done; i++) {
+        struct sgfp_header sub;
+        if (i >= n || reply.length - off < sizeof(sub)) {
+            done = -1;
+            break;
+        }
+        memcpy(&sub, c->reply + off, sizeof(sub));
+        off += sizeof(sub);
+        if (reply.length - off < sub.length || sub.id != (uint32_t) i) {
+            done = -1;
+            break;
+        }
+        op_decode(&ops[i], &sub, c->reply + off);
+        off += sub.length;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return done;
+}
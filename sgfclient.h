@@ -0,0 +1,51 @@
+#ifndef SGFCLIENT_H
+#define SGFCLIENT_H
+
+#include "sgfproto.h"
+
+// Connexion à sgfd. Plusieurs threads peuvent la partager, leurs appels sont alors sérialisés.
+struct sgfc;
+
+// Entrée rendue par sgfc_readdir
+struct sgfc_dirent {
+    int inum;
+    int type;
+    char name[SGFP_NAMESIZE];
+};
+
+// Requête d'un lot envoyé par sgfc_batch
+struct sgfc_op {
+    int op;             // SGFP_OPEN, SGFP_READ, SGFP_WRITE, SGFP_MKDIR ou SGFP_RENAME
+    int flags;          // SGFP_OPEN : SGFP_CREATE
+    int inum;           // SGFP_READ, SGFP_WRITE
+    int offset;
+    int length;         // SGFP_READ : taille de buf ; SGFP_WRITE : octets de buf
+    const char *path;   // SGFP_OPEN, SGFP_MKDIR, source de SGFP_RENAME
+    const char *path2;  // Destination de SGFP_RENAME
+    void *buf;          // SGFP_READ : reçoit les données ; SGFP_WRITE : données ; SGFP_OPEN : struct sgfp_attr, peut être NULL
+    int status;         // Reçoit le status de la réponse
+};
+
+// Les fonctions rendent -1 en cas d'erreur de communication, sinon le status de la réponse
+
+struct sgfc *sgfc_connect(const char *path);
+
+void sgfc_close(struct sgfc *c);
+
+int sgfc_open(struct sgfc *c, const char *path, int flags, struct sgfp_attr *attr);
+
+int sgfc_read(struct sgfc *c, int inum, char *data, int length, int offset);
+
+int sgfc_write(struct sgfc *c, int inum, const char *data, int length, int offset);
+
+int sgfc_stat(struct sgfc *c, const int inums[], struct sgfp_stat stats[], int n);
+
+int sgfc_readdir(struct sgfc *c, int dir, int *cursor, struct sgfc_dirent entries[], int max);
+
+int sgfc_mkdir(struct sgfc *c, const char *path);
+
+int sgfc_rename(struct sgfc *c, const char *src, const char *dst);
+
+int sgfc_batch(struct sgfc *c, struct sgfc_op ops[], int n);
+
+#endif
@@ -0,0 +1,808 @@
+#define _GNU_SOURCE
+
+#include "fileSystem.h"
+#include "sgfproto.h"
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define SGFD_THREADS 8        // Threads de service par défaut
+#define SGFD_EVENTS 64        // Événements lus par appel à epoll_wait
+#define SGFD_READ_CHUNK 65536 // Octets lus au plus par appel sur une connexion
+#define SGFD_MAX_QUEUED (4 * SGFP_MAX_PAYLOAD) // Requêtes et réponses en attente d'une connexion
+                                               // au-delà desquelles elle n'est plus lue
+#define SGFD_SOCKET_MODE 0600 // Droits de la socket : elle donne accès à toute l'image
+
+// Requête complète reçue, en attente d'un thread de service
+struct sgfd_request {
+    struct sgfp_header hdr;
+    char *payload;
+    struct sgfd_request *next;
+};
+
+// Connexion d'un client, avec sa propre session. Le tampon d'entrée n'appartient qu'à la boucle
+// d'événements, les files, les drapeaux et les événements suivis sont protégés par le verrou du serveur.
+struct sgfd_conn {
+    int fd;
+    struct sgf_session *session;
+    char *in;                   // Octets reçus qui ne forment pas encore une trame complète
+    size_t inlen;
+    size_t incap;
+    struct sgfd_request *head;  // Requêtes reçues, servies dans l'ordre
+    struct sgfd_request *tail;
+    size_t queued;              // Octets des requêtes en attente
+    char *out;                  // Réponses que la socket n'a pas encore acceptées
+    size_t outlen;
+    size_t outcap;
+    uint32_t events;            // Événements suivis par la boucle, 0 si elle ne suit plus la socket
+    int scheduled;              // Dans la file de service ou servie par un thread
+    int closing;                // Plus suivie par la boucle : libérée par le thread qui la sert
+    struct sgfd_conn *next_ready;
+    struct sgfd_conn *prev;     // Liste de toutes les connexions
+    struct sgfd_conn *next;
+};
+
+struct sgfd_server {
+    struct sgf_mount *fs;
+    const char *path;             // Socket d'écoute, NULL tant qu'elle n'est pas créée
+    int listen_fd;
+    int epoll_fd;
+    int signal_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct sgfd_conn *ready_head; // Connexions ayant des requêtes, servies à tour de rôle
+    struct sgfd_conn *ready_tail;
+    struct sgfd_conn *conns;
+    int stopping;
+    int nthreads;
+    pthread_t *threads;
+};
+
+// Tampon de réponse d'un thread de service
+struct sgfd_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static int buf_reserve(struct sgfd_buf *b, size_t n) {
+    if (b->len + n <= b->cap) {
+        return 1;
+    }
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + n)
+        cap *= 2;
+    char *data = realloc(b->data, cap);
+    if (data == NULL) {
+        return 0;
+    }
+    b->data = data;
+    b->cap = cap;
+    return 1;
+}
+
+static int buf_put(struct sgfd_buf *b, const void *data, size_t n) {
+    if (!buf_reserve(b, n)) {
+        return 0;
+    }
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+    return 1;
+}
+
+static int32_t get32(const char *p) {
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * Copie un chemin d'une trame en lui ajoutant son terminateur
+ *
+ * @return vrai si le chemin n'est ni vide ni trop long
+ */
+static int frame_path(char path[FS_PATHSIZE], const char *p, uint32_t len) {
+    if (len == 0 || len >= FS_PATHSIZE || memchr(p, '\0', len) != NULL) {
+        return 0;
+    }
+    memcpy(path, p, len);
+    path[len] = '\0';
+    return 1;
+}
+
+// Vrai si l'inode est un fichier : READ et WRITE ne touchent pas aux répertoires
+static int is_file(struct sgf_mount *fs, int inum) {
+    struct fs_stat st;
+    return fs_stat_many(fs, &inum, &st, 1) == 1 && !(st.isvalid & INODE_DIR);
+}
+
+static int32_t op_open(struct sgfd_conn *c, struct sgf_mount *fs, const char *p, uint32_t len, struct sgfd_buf *out) {
+    char path[FS_PATHSIZE];
+    if (len < 4 || !frame_path(path, p + 4, len - 4)) {
+        return SGFP_EPROTO;
+    }
+    struct fs_dirent entry;
+    int found = fs_resolve(fs, fs_getcwd(c->session), path, &entry);
+    if (!found && (get32(p) & SGFP_CREATE) && fs_touch(c->session, path))
+        found = fs_resolve(fs, fs_getcwd(c->session), path, &entry);
+    if (!found) {
+        return 0;
+    }
+
+    struct fs_stat st;
+    fs_stat_many(fs, &entry.inum, &st, 1);
+    struct sgfp_attr attr = {entry.inum, entry.type, st.size};
+    return buf_put(out, &attr, sizeof(attr)) ? 1 : -1;
+}
+
+static int32_t op_read(struct sgf_mount *fs, const char *p, uint32_t len, struct sgfd_buf *out) {
+    if (len != 12) {
+        return SGFP_EPROTO;
+    }
+    int inum = get32(p), offset = get32(p + 4), length = get32(p + 8);
+    if (offset < 0 || length < 0 || length > SGFP_MAX_DATA) {
+        return SGFP_EPROTO;
+    }
+    if (!buf_reserve(out, length)) {
+        return -1;
+    }
+    // file_read refuse les répertoires sous le verrou de l'inode ;
+    // is_file ne sert ici qu'à qualifier l'échec
+    int n = fs_read(fs, inum, out->data + out->len, length, offset);
+    if (n > 0)
+        out->len += n;
+    else if (n < 0 && !is_file(fs, inum))
+        return SGFP_ETYPE;
+    return n;
+}
+
+static int32_t op_write(struct sgf_mount *fs, const char *p, uint32_t len) {
+    if (len < 8 || get32(p + 4) < 0) {
+        return SGFP_EPROTO;
+    }
+    int inum = get32(p);
+    if (!is_file(fs, inum)) {
+        return SGFP_ETYPE;
+    }
+    return fs_write(fs, inum, p + 8, len - 8, get32(p + 4));
+}
+
+static int32_t op_stat(struct sgf_mount *fs, const char *p, uint32_t len, struct sgfd_buf *out) {
+    if (len % 4 != 0) {
+        return SGFP_EPROTO;
+    }
+    int n = len / 4;
+    if ((size_t) n * sizeof(struct sgfp_stat) > SGFP_MAX_PAYLOAD) {
+        return SGFP_ETOOBIG;
+    }
+    int *inums = malloc(n * sizeof(int) + 1);
+    struct fs_stat *stats = malloc(n * sizeof(struct fs_stat) + 1);
+    if (inums == NULL || stats == NULL || !buf_reserve(out, n * sizeof(struct sgfp_stat))) {
+        free(inums);
+        free(stats);
+        return -1;
+    }
+    for (int i = 0; i < n; i++)
+        inums[i] = get32(p + 4 * i);
+    int nvalid = fs_stat_many(fs, inums, stats, n);
+    for (int i = 0; nvalid >= 0 && i < n; i++) {
+        struct sgfp_stat st = {stats[i].inum, stats[i].isvalid, stats[i].size};
+        buf_put(out, &st, sizeof(st));
+    }
+    free(inums);
+    free(stats);
+    return nvalid;
+}
+
+static int32_t op_readdir(struct sgf_mount *fs, const char *p, uint32_t len, struct sgfd_buf *out) {
+    if (len != 12) {
+        return SGFP_EPROTO;
+    }
+    struct fs_directory dir = {1, get32(p), ""};
+    int cursor = get32(p + 4), max = get32(p + 8);
+    if (max <= 0 || max > FS_READDIR_BATCH) {
+        return SGFP_EPROTO;
+    }
+    struct fs_dirent *entries = malloc(max * sizeof(struct fs_dirent));
+    if (entries == NULL) {
+        return -1;
+    }
+    int n = fs_readdir(fs, dir, &cursor, entries, max);
+    int ok = n < 0 || buf_put(out, &cursor, sizeof(int32_t));
+    for (int i = 0; ok && i < n; i++) {
+        struct sgfp_dirent de = {entries[i].inum, entries[i].type, strlen(entries[i].name)};
+        ok = buf_put(out, &de, sizeof(de)) && buf_put(out, entries[i].name, de.name_len);
+    }
+    free(entries);
+    return ok ? n : -1;
+}
+
+static int32_t op_rename(struct sgfd_conn *c, const char *p, uint32_t len) {
+    char src[FS_PATHSIZE], dst[FS_PATHSIZE];
+    if (len < 4) {
+        return SGFP_EPROTO;
+    }
+    uint32_t srclen = get32(p);
+    if (srclen > len - 4 || !frame_path(src, p + 4, srclen) || !frame_path(dst, p + 4 + srclen, len - 4 - srclen)) {
+        return SGFP_EPROTO;
+    }
+    return fs_rename(c->session, src, dst);
+}
+
+static int32_t op_batch(struct sgfd_server *srv, struct sgfd_conn *c, const char *p, uint32_t len,
+                        struct sgfd_buf *out, size_t limit);
+
+/**
+ * Exécute une requête et ajoute sa trame de réponse au tampon.
+ * Une réponse plus longue que limit est remplacée par une réponse vide.
+ *
+ * @param hdr En-tête de la requête
+ * @param p Données de la requête
+ * @param limit Taille maximale des données de la réponse
+ * @param nested Vrai pour une requête d'un lot, qui ne peut pas être elle-même un lot
+ * @return faux si la mémoire manque pour la réponse
+ */
+static int serve_frame(struct sgfd_server *srv, struct sgfd_conn *c, const struct sgfp_header *hdr,
+                       const char *p, struct sgfd_buf *out, size_t limit, int nested) {
+    size_t at = out->len;
+    if (!buf_reserve(out, sizeof(struct sgfp_header))) {
+        return 0;
+    }
+    out->len += sizeof(struct sgfp_header);
+
+    int32_t status;
+    switch (hdr->op) {
+        case SGFP_OPEN:
+            status = op_open(c, srv->fs, p, hdr->length, out);
+            break;
+        case SGFP_READ:
+            status = op_read(srv->fs, p, hdr->length, out);
+            break;
+        case SGFP_WRITE:
+            status = op_write(srv->fs, p, hdr->length);
+            break;
+        case SGFP_STAT:
+            status = op_stat(srv->fs, p, hdr->length, out);
+            break;
+        case SGFP_READDIR:
+            status = op_readdir(srv->fs, p, hdr->length, out);
+            break;
+        case SGFP_MKDIR: {
+            char path[FS_PATHSIZE];
+            status = frame_path(path, p, hdr->length) ? fs_mkdir(c->session, path) : SGFP_EPROTO;
+            break;
+        }
+        case SGFP_RENAME:
+            status = op_rename(c, p, hdr->length);
+            break;
+        case SGFP_BATCH:
+            status = nested ? SGFP_EPROTO : op_batch(srv, c, p, hdr->length, out, limit);
+            break;
+        default:
+            status = SGFP_EPROTO;
+    }
+    if (out->len - at - sizeof(struct sgfp_header) > limit) {
+        out->len = at + sizeof(struct sgfp_header);
+        status = SGFP_ETOOBIG;
+    }
+
+    struct sgfp_header reply = {out->len - at - sizeof(struct sgfp_header), hdr->id, hdr->op, 0, status};
+    memcpy(out->data + at, &reply, sizeof(reply));
+    return 1;
+}
+
+/**
+ * Exécute dans l'ordre les requêtes d'un lot, leurs réponses forment les données de la réponse du lot.
+ * Le lot s'arrête quand la réponse n'a plus la place d'un en-tête.
+ *
+ * @param limit Taille maximale des réponses réunies
+ * @return Nombre de requêtes exécutées, SGFP_EPROTO si le lot est mal formé
+ */
+static int32_t op_batch(struct sgfd_server *srv, struct sgfd_conn *c, const char *p, uint32_t len,
+                        struct sgfd_buf *out, size_t limit) {
+    size_t start = out->len;
+    int32_t count = 0;
+    uint32_t off = 0;
+    while (off < len && out->len - start + sizeof(struct sgfp_header) <= limit) {
+        struct sgfp_header hdr;
+        if (len - off < sizeof(hdr)) {
+            return SGFP_EPROTO;
+        }
+        memcpy(&hdr, p + off, sizeof(hdr));
+        off += sizeof(hdr);
+        if (hdr.length > len - off) {
+            return SGFP_EPROTO;
+        }
+        size_t room = limit - (out->len - start) - sizeof(struct sgfp_header);
+        if (!serve_frame(srv, c, &hdr, p + off, out, room, 1)) {
+            return -1;
+        }
+        off += hdr.length;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Envoie ce que la socket accepte sans attendre
+ *
+ * @return Octets envoyés, -1 si la connexion est rompue
+ */
+static ssize_t send_some(int fd, const char *data, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send(fd, data + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            return -1;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+/**
+ * Ajuste les événements suivis sur une connexion : elle n'est plus lue tant que ses requêtes
+ * et réponses en attente dépassent SGFD_MAX_QUEUED, et son écriture est surveillée tant que
+ * des réponses attendent. Doit être appelé avec le verrou du serveur.
+ */
+static void conn_watch(struct sgfd_server *srv, struct sgfd_conn *c) {
+    if (c->closing) {
+        return;
+    }
+    uint32_t events = (c->queued + c->outlen < SGFD_MAX_QUEUED ? EPOLLIN : 0) | (c->outlen > 0 ? EPOLLOUT : 0);
+    if (events == c->events) {
+        return;
+    }
+    // Sans événement, la socket est retirée : une fin de flux ne serait plus signalée sans arrêt
+    struct epoll_event ev = {.events = events, .data.ptr = c};
+    if (events == 0)
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    else
+        epoll_ctl(srv->epoll_fd, c->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+/**
+ * Ajoute des réponses à celles qui attendent la socket. Doit être appelé avec le verrou du serveur.
+ *
+ * @return faux si la mémoire manque
+ */
+static int conn_queue_out(struct sgfd_conn *c, const char *data, size_t len) {
+    if (c->outlen + len > c->outcap) {
+        size_t cap = c->outcap ? c->outcap : 4096;
+        while (cap < c->outlen + len)
+            cap *= 2;
+        char *out = realloc(c->out, cap);
+        if (out == NULL) {
+            return 0;
+        }
+        c->out = out;
+        c->outcap = cap;
+    }
+    memcpy(c->out + c->outlen, data, len);
+    c->outlen += len;
+    return 1;
+}
+
+// Ajoute une connexion à la file de service. Doit être appelé avec le verrou du serveur.
+static void conn_schedule(struct sgfd_server *srv, struct sgfd_conn *c) {
+    if (c->scheduled) {
+        return;
+    }
+    c->scheduled = 1;
+    c->next_ready = NULL;
+    if (srv->ready_tail)
+        srv->ready_tail->next_ready = c;
+    else
+        srv->ready_head = c;
+    srv->ready_tail = c;
+    pthread_cond_signal(&srv->ready);
+}
+
+// Libère une connexion et ses requêtes restantes. Doit être appelé avec le verrou du serveur.
+static void conn_free(struct sgfd_server *srv, struct sgfd_conn *c) {
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        srv->conns = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    while (c->head) {
+        struct sgfd_request *req = c->head;
+        c->head = req->next;
+        free(req->payload);
+        free(req);
+    }
+    // Dernières réponses, si la socket les accepte encore
+    if (c->outlen > 0)
+        send_some(c->fd, c->out, c->outlen);
+    close(c->fd);
+    fs_session_close(c->session);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+/**
+ * Retire une connexion de la boucle d'événements, elle sera libérée
+ * par un thread de service après ses requêtes en attente
+ */
+static void conn_close(struct sgfd_server *srv, struct sgfd_conn *c) {
+    pthread_mutex_lock(&srv->lock);
+    if (c->events != 0)
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->events = 0;
+    c->closing = 1;
+    conn_schedule(srv, c);
+    pthread_mutex_unlock(&srv->lock);
+}
+
+/**
+ * Thread de service : les connexions sont servies à tour de rôle, une requête à la fois,
+ * une connexion n'est jamais servie par deux threads en même temps. Les réponses sont
+ * envoyées sans attendre ; ce que la socket refuse est confié à la boucle d'événements,
+ * et la connexion n'est plus servie tant que ses réponses en attente sont trop nombreuses.
+ */
+static void *sgfd_worker(void *arg) {
+    struct sgfd_server *srv = arg;
+    struct sgfd_buf out = {NULL, 0, 0};
+
+    pthread_mutex_lock(&srv->lock);
+    while (1) {
+        while (srv->ready_head == NULL && !srv->stopping)
+            pthread_cond_wait(&srv->ready, &srv->lock);
+        struct sgfd_conn *c = srv->ready_head;
+        if (c == NULL) {
+            break;
+        }
+        srv->ready_head = c->next_ready;
+        if (srv->ready_head == NULL)
+            srv->ready_tail = NULL;
+
+        struct sgfd_request *req = c->head;
+        if (req == NULL) {
+            // Seule une connexion fermée est servie sans requête
+            conn_free(srv, c);
+            continue;
+        }
+        c->head = req->next;
+        if (c->head == NULL)
+            c->tail = NULL;
+        int direct = c->outlen == 0;
+        pthread_mutex_unlock(&srv->lock);
+
+        // Seul ce thread produit des réponses pour la connexion : sans réponse en attente,
+        // la boucle n'écrit pas sur la socket et l'envoi direct garde l'ordre des réponses
+        out.len = 0;
+        ssize_t sent = 0;
+        int served = serve_frame(srv, c, &req->hdr, req->payload, &out, SGFP_MAX_PAYLOAD, 0);
+        if (served && direct)
+            sent = send_some(c->fd, out.data, out.len);
+
+        pthread_mutex_lock(&srv->lock);
+        c->queued -= sizeof(struct sgfp_header) + req->hdr.length;
+        if (served && sent >= 0 && (size_t) sent < out.len)
+            conn_queue_out(c, out.data + sent, out.len - sent);
+        free(req->payload);
+        free(req);
+        c->scheduled = 0;
+        conn_watch(srv, c);
+        if ((c->head != NULL && c->outlen < SGFD_MAX_QUEUED) || c->closing)
+            conn_schedule(srv, c);
+    }
+    pthread_mutex_unlock(&srv->lock);
+    free(out.data);
+    return NULL;
+}
+
+/**
+ * Découpe en requêtes les trames complètes reçues sur une connexion
+ *
+ * @return faux si une trame est trop grande ou si la mémoire manque
+ */
+static int conn_parse(struct sgfd_server *srv, struct sgfd_conn *c) {
+    size_t off = 0;
+    struct sgfd_request *first = NULL, *last = NULL;
+    int ok = 1;
+    while (c->inlen - off >= sizeof(struct sgfp_header)) {
+        struct sgfp_header hdr;
+        memcpy(&hdr, c->in + off, sizeof(hdr));
+        if (hdr.length > SGFP_MAX_PAYLOAD) {
+            ok = 0;
+            break;
+        }
+        if (c->inlen - off - sizeof(hdr) < hdr.length)
+            break;
+
+        struct sgfd_request *req = malloc(sizeof(struct sgfd_request));
+        char *payload = malloc(hdr.length + 1);
+        if (req == NULL || payload == NULL) {
+            free(req);
+            free(payload);
+            ok = 0;
+            break;
+        }
+        req->hdr = hdr;
+        req->payload = payload;
+        req->next = NULL;
+        memcpy(payload, c->in + off + sizeof(hdr), hdr.length);
+        off += sizeof(hdr) + hdr.length;
+        if (last)
+            last->next = req;
+        else
+            first = req;
+        last = req;
+    }
+    memmove(c->in, c->in + off, c->inlen - off);
+    c->inlen -= off;
+
+    if (first != NULL) {
+        pthread_mutex_lock(&srv->lock);
+        if (c->tail)
+            c->tail->next = first;
+        else
+            c->head = first;
+        c->tail = last;
+        for (struct sgfd_request *req = first; req != NULL; req = req->next)
+            c->queued += sizeof(struct sgfp_header) + req->hdr.length;
+        conn_watch(srv, c);
+        if (c->outlen < SGFD_MAX_QUEUED)
+            conn_schedule(srv, c);
+        pthread_mutex_unlock(&srv->lock);
+    }
+    return ok;
+}
+
+// Lit ce qui est disponible sur une connexion, la ferme à la fin du flux ou en cas d'erreur
+static void conn_readable(struct sgfd_server *srv, struct sgfd_conn *c) {
+    if (c->incap - c->inlen < SGFD_READ_CHUNK) {
+        size_t cap = c->incap ? c->incap : SGFD_READ_CHUNK;
+        while (cap - c->inlen < SGFD_READ_CHUNK)
+            cap *= 2;
+        char *in = realloc(c->in, cap);
+        if (in == NULL) {
+            conn_close(srv, c);
+            return;
+        }
+        c->in = in;
+        c->incap = cap;
+    }
+
+    ssize_t n = recv(c->fd, c->in + c->inlen, SGFD_READ_CHUNK, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0) {
+        conn_close(srv, c);
+        return;
+    }
+    c->inlen += n;
+    if (!conn_parse(srv, c))
+        conn_close(srv, c);
+}
+
+/**
+ * Envoie les réponses en attente sur une connexion devenue inscriptible. Une connexion
+ * qui n'était plus servie faute de place le redevient.
+ */
+static void conn_writable(struct sgfd_server *srv, struct sgfd_conn *c) {
+    pthread_mutex_lock(&srv->lock);
+    if (!c->closing && c->outlen > 0) {
+        ssize_t sent = send_some(c->fd, c->out, c->outlen);
+        if (sent < 0) {
+            // Connexion rompue : la lecture en verra la fin
+            c->outlen = 0;
+        } else {
+            memmove(c->out, c->out + sent, c->outlen - sent);
+            c->outlen -= sent;
+        }
+        conn_watch(srv, c);
+        if (c->head != NULL && c->outlen < SGFD_MAX_QUEUED)
+            conn_schedule(srv, c);
+    }
+    pthread_mutex_unlock(&srv->lock);
+}
+
+// Accepte les connexions en attente, chacune avec sa session sur le montage
+static void sgfd_accept(struct sgfd_server *srv) {
+    while (1) {
+        int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EINTR)
+                printf("Erreur accept: %s\n", strerror(errno));
+            if (errno != EINTR)
+                return;
+            continue;
+        }
+
+        struct sgfd_conn *c = calloc(1, sizeof(struct sgfd_conn));
+        if (c == NULL || (c->session = fs_session_open(srv->fs)) == NULL) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+
+        pthread_mutex_lock(&srv->lock);
+        c->next = srv->conns;
+        if (srv->conns)
+            srv->conns->prev = c;
+        srv->conns = c;
+        pthread_mutex_unlock(&srv->lock);
+
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+        if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+            conn_close(srv, c);
+        else
+            c->events = EPOLLIN;
+    }
+}
+
+/**
+ * Crée la socket d'écoute, la boucle d'événements et le descripteur des signaux d'arrêt.
+ * Un ancien fichier socket au même chemin est remplacé, tout autre fichier est laissé.
+ * La socket est créée avec les droits SGFD_SOCKET_MODE, quel que soit l'umask : seuls
+ * le propriétaire du démon et root peuvent s'y connecter.
+ *
+ * @return vrai en cas de succès
+ */
+static int sgfd_listen(struct sgfd_server *srv, const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Chemin de socket trop long: %s\n", path);
+        return 0;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    mode_t umask_saved = umask(0777 & ~SGFD_SOCKET_MODE);
+    int bound = srv->listen_fd >= 0 && bind(srv->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+    umask(umask_saved);
+    if (!bound || listen(srv->listen_fd, SOMAXCONN) != 0) {
+        printf("Erreur socket %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    srv->path = path;
+
+    // SIGINT et SIGTERM arrivent par la boucle d'événements, les threads créés ensuite les bloquent aussi
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    srv->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event lev = {.events = EPOLLIN, .data.ptr = &srv->listen_fd};
+    struct epoll_event sev = {.events = EPOLLIN, .data.ptr = &srv->signal_fd};
+    if (srv->signal_fd < 0 || srv->epoll_fd < 0
+        || epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listen_fd, &lev) != 0
+        || epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->signal_fd, &sev) != 0) {
+        printf("Erreur epoll: %s\n", strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+// Boucle d'événements, jusqu'à SIGINT ou SIGTERM
+static void sgfd_loop(struct sgfd_server *srv) {
+    struct epoll_event events[SGFD_EVENTS];
+    while (1) {
+        int n = epoll_wait(srv->epoll_fd, events, SGFD_EVENTS, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            printf("Erreur epoll: %s\n", strerror(errno));
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &srv->signal_fd) {
+                return;
+            } else if (events[i].data.ptr == &srv->listen_fd) {
+                sgfd_accept(srv);
+            } else {
+                struct sgfd_conn *c = events[i].data.ptr;
+                if (events[i].events & EPOLLOUT)
+                    conn_writable(srv, c);
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    conn_readable(srv, c);
+            }
+        }
+    }
+}
+
+/**
+ * Arrête le serveur : les requêtes déjà reçues sont servies, puis toutes
+ * les connexions sont fermées avant que les threads de service ne s'arrêtent
+ */
+static void sgfd_stop(struct sgfd_server *srv) {
+    if (srv->path != NULL)
+        unlink(srv->path);
+
+    pthread_mutex_lock(&srv->lock);
+    for (struct sgfd_conn *c = srv->conns; c != NULL; c = c->next) {
+        if (!c->closing) {
+            if (c->events != 0)
+                epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+            c->events = 0;
+            c->closing = 1;
+            conn_schedule(srv, c);
+        }
+    }
+    srv->stopping = 1;
+    pthread_cond_broadcast(&srv->ready);
+    pthread_mutex_unlock(&srv->lock);
+
+    for (int i = 0; i < srv->nthreads; i++)
+        pthread_join(srv->threads[i], NULL);
+    if (srv->listen_fd >= 0)
+        close(srv->listen_fd);
+    if (srv->epoll_fd >= 0)
+        close(srv->epoll_fd);
+    if (srv->signal_fd >= 0)
+        close(srv->signal_fd);
+}
+
+int main(int argc, char *argv[]) {
+    struct sgf_disk disk;
+    struct sgfd_server srv;
+
+    if (argc != 3 && argc != 4) {
+        printf("Utilisation: %s <NomDuDisque> <socket> [threads]\n", argv[0]);
+        return 1;
+    }
+
+    if (!intialisation_disque(&disk, argv[1], 0)) {
+        printf("Erreur d'initialisation %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    memset(&srv, 0, sizeof(srv));
+    srv.listen_fd = srv.epoll_fd = srv.signal_fd = -1;
+    srv.fs = fs_mount(&disk);
+    if (srv.fs == NULL) {
+        printf("montage erreur\n");
+        disque_close(&disk);
+        return 1;
+    }
+    pthread_mutex_init(&srv.lock, NULL);
+    pthread_cond_init(&srv.ready, NULL);
+
+    srv.nthreads = argc == 4 && atoi(argv[3]) > 0 ? atoi(argv[3]) : SGFD_THREADS;
+    srv.threads = malloc(srv.nthreads * sizeof(pthread_t));
+    int ok = srv.threads != NULL && sgfd_listen(&srv, argv[2]);
+    int started = 0;
+    while (ok && started < srv.nthreads && pthread_create(&srv.threads[started], NULL, sgfd_worker, &srv) == 0)
+        started++;
+    srv.nthreads = started;
+
+    if (ok && started > 0) {
+        printf("Disque %s servi sur %s par %d threads\n", argv[1], argv[2], started);
+        fflush(stdout);
+        sgfd_loop(&srv);
+    }
+    sgfd_stop(&srv);
+
+    printf("Fermeture du disque.\n");
+    free(srv.threads);
+    pthread_cond_destroy(&srv.ready);
+    pthread_mutex_destroy(&srv.lock);
+    fs_umount(srv.fs);
+    disque_close(&disk);
+    return ok && started > 0 ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#ifndef SGFPROTO_H
+#define SGFPROTO_H
+
+#include <stdint.h>
+
+/*
+ * Protocole binaire entre sgfd et ses clients, sur une socket Unix locale.
+ *
+ * Chaque message est une trame : un en-tête struct sgfp_header suivi de length octets.
+ * Les entiers sont dans l'ordre des octets de l'hôte, client et serveur étant sur la même machine.
+ * Les chemins et les noms ne sont pas terminés par un zéro, leur longueur découle de celle de la trame.
+ *
+ * Un client peut envoyer plusieurs requêtes sans attendre : les réponses reviennent dans
+ * l'ordre des requêtes, avec le même id.
+ */
+
+#define SGFP_MAX_PAYLOAD (1 << 20)  // Taille maximale des données d'une trame
+#define SGFP_MAX_DATA (SGFP_MAX_PAYLOAD - 64) // Octets lus ou écrits au plus par une requête
+#define SGFP_NAMESIZE 256           // Comme NAMESIZE, terminateur compris
+
+// Opérations, champ op de l'en-tête
+#define SGFP_OPEN 1     // flags, chemin                    -> struct sgfp_attr
+#define SGFP_READ 2     // inum, offset, length             -> données lues
+#define SGFP_WRITE 3    // inum, offset, données            -> status = octets écrits
+#define SGFP_STAT 4     // inums[]                          -> struct sgfp_stat[]
+#define SGFP_READDIR 5  // inum, cursor, max                -> cursor, entrées struct sgfp_dirent
+#define SGFP_MKDIR 6    // chemin                           -> status
+#define SGFP_RENAME 7   // longueur de la source, source, destination -> status
+#define SGFP_BATCH 8    // trames de requêtes               -> trames des réponses, dans le même ordre
+
+#define SGFP_CREATE 1   // SGFP_OPEN : crée le fichier s'il n'existe pas
+
+// Valeurs de status propres au protocole. Sinon status est le résultat de l'appel
+// au système de fichiers : vrai ou nombre d'octets en cas de succès, 0 ou -1 sinon.
+#define SGFP_EPROTO -2  // Trame mal formée ou opération inconnue
+#define SGFP_ETYPE -3   // READ ou WRITE sur un inode qui n'est pas un fichier
+#define SGFP_ETOOBIG -4 // La réponse dépasserait SGFP_MAX_PAYLOAD
+
+struct sgfp_header {
+    uint32_t length;   // Octets qui suivent l'en-tête
+    uint32_t id;       // Choisi par le client, recopié dans la réponse
+    uint16_t op;
+    uint16_t flags;    // Réservé, 0
+    int32_t status;    // Réponse seulement
+};
+
+// Attributs rendus par SGFP_OPEN
+struct sgfp_attr {
+    int32_t inum;
+    int32_t type;      // type = 1 pour fichier , type = 0 pour répertoire
+    int32_t size;
+};
+
+// Attributs rendus par SGFP_STAT
+struct sgfp_stat {
+    int32_t inum;
+    int32_t isvalid;   // Drapeaux de l'inode, 0 s'il est libre
+    int32_t size;
+};
+
+// En-tête d'une entrée rendue par SGFP_READDIR, suivi de name_len octets du nom
+struct sgfp_dirent {
+    int32_t inum;
+    uint8_t type;
+    uint8_t name_len;
+} __attribute__((packed));
+
+#endif
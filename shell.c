@@ -11,18 +11,24 @@ int main(int argc, char *argv[]) {
     char arg1[1024];
     char arg2[1024];
     int args;
+    struct sgf_disk disk;
+    struct sgf_mount *fs = NULL;
+    struct sgf_session *session = NULL;
 
-    if (argc != 2) {
+    if (argc != 2 && argc != 3) {
         printf("Veuillez renseigner deux paramètres: %s <NomDuDisque> <NombreDeBlocs>\n", argv[0]  );
         return 1;
     }
 
-    if (!intialisation_disque(argv[1])) {
-        printf("Erreur d'initialisation %s: %s\n", argv[1], strerror(errno));
+    if (!intialisation_disque(&disk, argv[1], argc == 3 ? atoi(argv[2]) : 0)) {
+        if (argc == 3 && errno == EINVAL)
+            printf("Erreur d'initialisation %s: l'image dépasse %s blocs et ne peut pas être réduite\n", argv[1], argv[2]);
+        else
+            printf("Erreur d'initialisation %s: %s\n", argv[1], strerror(errno));
         return 1;
     }
 
-    printf("Disque: %s utilisant %d blocks\n", argv[1], disque_size());
+    printf("Disque: %s utilisant %d blocks\n", argv[1], disque_size(&disk));
 
     while (1) {
         printf(" SGF-%s> ",argv[0]);
@@ -41,7 +47,7 @@ int main(int argc, char *argv[]) {
 
         if (!strcmp(cmd, "format")) {
             if (args == 1) {
-                if (fs_format()) {
+                if (fs_format(&disk)) {
                     printf("Disque formaté.\n");
                 } else {
                     printf("Erreur formatage!\n");
@@ -51,7 +57,8 @@ int main(int argc, char *argv[]) {
             }
         } else if (!strcmp(cmd, "mount")) {
             if (args == 1) {
-                if (fs_mount()) {
+                if (fs == NULL && (fs = fs_mount(&disk)) != NULL) {
+                    session = fs_session_open(fs);
                     printf("disque monté.\n");
                 } else {
                     printf("montage erreur\n");
@@ -59,35 +66,85 @@ int main(int argc, char *argv[]) {
             } else {
                 printf("Vous devez monter le disque\n");
             }
+        } else if (!strcmp(cmd, "lazyinit")) {
+            if (args == 1) {
+                if (fs_lazy_init(fs)) {
+                    printf("initialisation en arrière-plan lancée.\n");
+                } else {
+                    printf("Erreur initialisation\n");
+                }
+            }
+        } else if (!strcmp(cmd, "sync")) {
+            if (args == 1) {
+                if (fs_sync(fs)) {
+                    printf("données écrites sur le disque.\n");
+                } else {
+                    printf("Erreur synchronisation\n");
+                }
+            }
         } else if (!strcmp(cmd, "help")) {
             printf("Voici les commandes pouvant etre utilisés:\n");
             printf("format\n");
             printf("mount\n");
+            printf("lazyinit\n");
+            printf("sync\n");
             printf("help\n");
             printf("exit\n");
-            printf("ls\n");
+            printf("ls [-l]\n");
             printf("cd\n");
             printf("touch\n");
+            printf("mtouch <préfixe> <nombre>\n");
             printf("mkdir\n");
             printf("rmdir\n");
             printf("rm\n");
+            printf("mv <source> <destination>\n");
+            printf("du [chemin]\n");
+            printf("find -name <motif>\n");
+            printf("tree [chemin]\n");
         } else if (!strcmp(cmd, "cd")) {
             if (args == 2) {
-                if (fs_cd(arg1)) {
+                if (fs_cd(session, arg1)) {
                     printf("changement de répertoire\n");
                 }
             }
         } else if (!strcmp(cmd, "touch")) {
             if (args == 2) {
-                if (fs_touch(arg1)) {
+                if (fs_touch(session, arg1)) {
                     printf("fichier crée\n");
                 } else {
                     printf("Erreur création fichier\n");
                 }
             }
+        } else if (!strcmp(cmd, "mtouch")) {
+            if (args == 3 && atoi(arg2) > 0) {
+                int n = atoi(arg2);
+                char **names = malloc(n * sizeof(char *));
+                int built = 0;
+                while (names && built < n) {
+                    names[built] = malloc(strlen(arg1) + 12);
+                    if (names[built] == NULL)
+                        break;
+                    sprintf(names[built], "%s%d", arg1, built);
+                    built++;
+                }
+                if (built == n) {
+                    printf("%d fichiers crées\n", fs_create_many(fs, fs_getcwd(session), names, n));
+                } else {
+                    printf("Erreur allocation mémoire\n");
+                }
+                for (int i = 0; i < built; i++)
+                    free(names[i]);
+                free(names);
+            }
         } else if (!strcmp(cmd, "ls")) {
             if (args == 1) {
-                if (fs_ls()) {
+                if (fs_ls(session)) {
+                    printf("informations du répertoire\n");
+                } else {
+                    printf("Erreur consultation répertoire\n");
+                }
+            } else if (args == 2 && !strcmp(arg1, "-l")) {
+                if (fs_ls_long(session)) {
                     printf("informations du répertoire\n");
                 } else {
                     printf("Erreur consultation répertoire\n");
@@ -95,7 +152,7 @@ int main(int argc, char *argv[]) {
             }
         } else if (!strcmp(cmd, "mkdir")) {
             if (args == 2) {
-                if (fs_mkdir(arg1)) {
+                if (fs_mkdir(session, arg1)) {
                     printf("répertoire crée\n");
                 } else {
                     printf("Erreur création de répertoire\n");
@@ -103,7 +160,7 @@ int main(int argc, char *argv[]) {
             }
         } else if (!strcmp(cmd, "rmdir")) {
             if (args == 2) {
-                if (fs_rmdir(arg1)) {
+                if (fs_rmdir(session, arg1)) {
                     printf("répertoire supprimé\n");
                 } else {
                     printf("Erreur suppression du répertoire\n");
@@ -111,12 +168,38 @@ int main(int argc, char *argv[]) {
             }
         } else if (!strcmp(cmd, "rm")) {
             if (args == 2) {
-                if (fs_rm(arg1)) {
+                if (fs_rm(session, arg1)) {
                     printf("supprimé\n");
                 } else {
                     printf("Erreur suppression\n");
                 }
             }
+        } else if (!strcmp(cmd, "du")) {
+            if (args <= 2) {
+                if (!fs_du(session, args == 2 ? arg1 : NULL)) {
+                    printf("Erreur parcours\n");
+                }
+            }
+        } else if (!strcmp(cmd, "find")) {
+            if (args == 3 && !strcmp(arg1, "-name")) {
+                if (!fs_find(session, NULL, arg2)) {
+                    printf("Erreur parcours\n");
+                }
+            }
+        } else if (!strcmp(cmd, "tree")) {
+            if (args <= 2) {
+                if (!fs_tree(session, args == 2 ? arg1 : NULL)) {
+                    printf("Erreur parcours\n");
+                }
+            }
+        } else if (!strcmp(cmd, "mv")) {
+            if (args == 3) {
+                if (fs_rename(session, arg1, arg2)) {
+                    printf("déplacé\n");
+                } else {
+                    printf("Erreur déplacement\n");
+                }
+            }
         } else if (!strcmp(cmd, "exit")) {
             break;
         } else {
@@ -126,7 +209,9 @@ int main(int argc, char *argv[]) {
     }
 
     printf("Fermeture du disque.\n");
-    disque_close();
+    fs_session_close(session);
+    fs_umount(fs);
+    disque_close(&disk);
 
     return 0;
 }
\ No newline at end of file